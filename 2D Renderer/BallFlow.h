@@ -0,0 +1,148 @@
+#pragma once
+
+// std includes
+#include <cstdint>
+#include <vector>
+
+// SFML includes
+#include <SFML/Graphics.hpp>
+
+// custom includes
+#include "PhysicsSolver.cpp"
+
+/*
+* Continuous ball flow, emitters add balls and sinks take them away, once per frame in two batches
+* - removal first: one pass over the balls drops everything inside a sink or past its lifetime,
+*   PhysSolver::removeVerletObjectsIf compacts the survivors in place
+* - then emission into the slots that freed, the ball vectors keep their capacity so once a scene
+*   has reached its steady count nothing is allocated per ball
+* - spawn points follow a low discrepancy sequence rather than rand, so a flow scene is repeatable
+*/
+
+struct BallEmitter
+{
+	sf::FloatRect region; // spawn area in solver coordinates, balls start with their centre inside it
+	sf::Vector2f velocity; // px/s
+	float rate = 60.f; // balls per second
+	float lifetime = 0.f; // seconds before a ball is removed, 0 keeps it until a sink takes it
+	sf::Color color = sf::Color(50, 50, 50, 255);
+
+	float pending = 0.f; // fraction of a ball carried over to the next frame
+	double phaseU = 0.5; // where the spawn sequence is, wrapped into [0, 1) every emit so it never loses precision however long it runs
+	double phaseV = 0.5;
+};
+
+struct BallSink
+{
+	sf::FloatRect region; // balls whose centre is inside are removed
+};
+
+struct FlowStats
+{
+	uint64_t emitted = 0; // totals since the flow was created
+	uint64_t removedBySinks = 0;
+	uint64_t expired = 0;
+};
+
+class BallFlow
+{
+public:
+	std::vector<BallEmitter> emitters;
+	std::vector<BallSink> sinks;
+	size_t maxBalls = 20000; // emitters pause while the solver holds this many
+	FlowStats stats;
+
+	bool isActive() const
+	{
+		return !this->emitters.empty() || !this->sinks.empty();
+	}
+
+	void clear()
+	{
+		this->emitters.clear();
+		this->sinks.clear();
+	}
+
+	void addFountain(sf::Vector2f colliderPos) // sprays up from the lower left of the collider, drains at the bottom right
+	{
+		BallEmitter fountain;
+		fountain.region = sf::FloatRect(colliderPos.x - 200.f, colliderPos.y + 120.f, 16.f, 16.f);
+		fountain.velocity = sf::Vector2f(220.f, -650.f);
+		fountain.rate = 240.f;
+		fountain.lifetime = 30.f;
+		fountain.color = sf::Color(40, 90, 160, 255);
+		this->emitters.push_back(fountain);
+
+		BallSink drain;
+		drain.region = sf::FloatRect(colliderPos.x + 20.f, colliderPos.y + 240.f, 100.f, 60.f);
+		this->sinks.push_back(drain);
+	}
+
+	void update(PhysSolver& solver, float dt) // call once per frame before PhysSolver::update
+	{
+		this->removeBalls(solver);
+		this->emitBalls(solver, dt);
+	}
+
+private:
+	void removeBalls(PhysSolver& solver)
+	{
+		if (this->sinks.empty() && !solver.hasBallLifetimes)
+			return;
+
+		const sf::Vector2f centerOffset(solver.obj_radius, solver.obj_radius); // positions are the top left of the ball
+		uint64_t bySinks = 0;
+		uint64_t expired = 0;
+		solver.removeVerletObjectsIf([&](size_t i) {
+			if (solver.isBallExpired(i))
+			{
+				expired++;
+				return true;
+			}
+
+			const sf::Vector2f center = solver.verletObjList[i].curPos + centerOffset;
+			for (const BallSink& sink : this->sinks)
+			{
+				if (sink.region.contains(center))
+				{
+					bySinks++;
+					return true;
+				}
+			}
+			return false;
+		});
+
+		this->stats.removedBySinks += bySinks;
+		this->stats.expired += expired;
+	}
+
+	void emitBalls(PhysSolver& solver, float dt)
+	{
+		const sf::Vector2f centerOffset(solver.obj_radius, solver.obj_radius);
+		for (BallEmitter& emitter : this->emitters)
+		{
+			emitter.pending += emitter.rate * dt;
+			while (emitter.pending >= 1.f && solver.verletObjList.size() < this->maxBalls)
+			{
+				// R2 sequence, spreads consecutive balls evenly over the region
+				const float u = static_cast<float>(emitter.phaseU);
+				const float v = static_cast<float>(emitter.phaseV);
+				const sf::Vector2f center(emitter.region.left + u * emitter.region.width, emitter.region.top + v * emitter.region.height);
+
+				solver.addVerletObject(center - centerOffset, emitter.velocity);
+				solver.verletObjList.back().color = emitter.color;
+				if (emitter.lifetime > 0.f)
+					solver.setBallLifetime(solver.verletObjList.size() - 1, emitter.lifetime);
+
+				emitter.pending -= 1.f;
+				emitter.phaseU += 0.7548776662466927;
+				emitter.phaseV += 0.5698402909980532;
+				emitter.phaseU -= emitter.phaseU >= 1.0 ? 1.0 : 0.0;
+				emitter.phaseV -= emitter.phaseV >= 1.0 ? 1.0 : 0.0;
+				this->stats.emitted++;
+			}
+
+			emitter.pending = std::min(emitter.pending, 1.f); // no burst when a paused emitter resumes
+		}
+	}
+};
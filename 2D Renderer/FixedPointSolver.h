@@ -0,0 +1,221 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// custom includes
+#include "GridCollision.h"
+#include "PhysicsSolver.cpp"
+#include "VerletGrid.cpp"
+#include "util/fixed_point.h"
+#include "util/thread_pool.h"
+
+/*
+* Fixed point simulation mode
+* Runs the uniform scene (collider circle, equal balls, no segments or materials) with positions in Q16.16 integers.
+* The substep mirrors PhysSolver's: grid build -> collision stripes colour 0 -> colour 1 -> integrate + constrain,
+* with the same stripes and pair order (GridCollision.h), so it behaves like the float solver while every result is
+* exact integer arithmetic. Only the pair and constraint kernels below are Q16.16 specific.
+* Given the same starting positions it produces the same bits on any compiler, CPU or thread count.
+* The substep count is fixed instead of adaptive, picking it from the balls' speed would need a float decision.
+*/
+
+struct FixedPointSolver
+{
+	// ball state, one column per coordinate so the integrate loop runs over plain int32 lanes
+	std::vector<fixed_t> curX;
+	std::vector<fixed_t> curY;
+	std::vector<fixed_t> lastX;
+	std::vector<fixed_t> lastY;
+
+	// broadphase, the float solver's grid layout with the binning done in integers
+	VerletGrid grid;
+	fixed_t gridOriginX = 0;
+	fixed_t gridOriginY = 0;
+	fixed_t cellSize = fixed_one;
+
+	// settings, converted once when a scene is loaded
+	fixed_t colliderX = 0; // collider centre minus the ball radius, positions are the top left of a ball
+	fixed_t colliderY = 0;
+	fixed_t colliderLimit = 0; // collider radius minus the ball radius
+	fixed_t minDist = 0; // two ball radii
+	fixed_t response = 0; // share of the overlap resolved per substep
+	fixed_t gravityStepX = 0; // gravity * sub_dt^2, what a substep adds to the velocity
+	fixed_t gravityStepY = 0;
+	int subSteps = 8;
+	float subDt = 0.f;
+
+	ThreadPool* threadPool = nullptr; // optional, runs single threaded without one
+	const size_t objChunkSize = 1024;
+	const int collisionStripeWidth = 2;
+
+	size_t size() const
+	{
+		return curX.size();
+	}
+
+	void loadFrom(const PhysSolver& world, float dt, int stepsPerFrame) // converts the balls and settings, segments and materials are not supported
+	{
+		subSteps = std::max(1, stepsPerFrame);
+		subDt = dt / static_cast<float>(subSteps);
+
+		colliderX = FloatToFixed(world.collider_pos.x - world.obj_radius);
+		colliderY = FloatToFixed(world.collider_pos.y - world.obj_radius);
+		colliderLimit = FloatToFixed(world.collider_radius - world.obj_radius);
+		minDist = FloatToFixed(world.obj_radius * 2.f);
+		response = FloatToFixed(world.collision_response);
+		gravityStepX = FloatToFixed(world.gravity.x * subDt * subDt);
+		gravityStepY = FloatToFixed(world.gravity.y * subDt * subDt);
+
+		grid.configure(world.verletScreenGrid.origin, sf::Vector2f(world.verletScreenGrid.width * world.verletScreenGrid.cellSize, world.verletScreenGrid.height * world.verletScreenGrid.cellSize), world.verletScreenGrid.cellSize);
+		gridOriginX = FloatToFixed(grid.origin.x);
+		gridOriginY = FloatToFixed(grid.origin.y);
+		cellSize = FloatToFixed(grid.cellSize);
+
+		// the float solver's velocity is per its own substep, rescale it to ours
+		const float ratio = world.currentSubDt > 0.f ? subDt / world.currentSubDt : 1.f;
+		const size_t count = world.verletObjList.size();
+		curX.resize(count);
+		curY.resize(count);
+		lastX.resize(count);
+		lastY.resize(count);
+		for (size_t i = 0; i < count; i++)
+		{
+			const VerletObject& obj = world.verletObjList[i];
+			const sf::Vector2f last = ratio == 1.f ? obj.lastPos : obj.curPos - (obj.curPos - obj.lastPos) * ratio;
+			curX[i] = FloatToFixed(obj.curPos.x);
+			curY[i] = FloatToFixed(obj.curPos.y);
+			lastX[i] = FloatToFixed(last.x);
+			lastY[i] = FloatToFixed(last.y);
+		}
+	}
+
+	void storeTo(PhysSolver& world) const // writes the positions back into a solver holding the same balls, for drawing or comparing
+	{
+		world.currentSubDt = subDt;
+		for (size_t i = 0; i < std::min(size(), world.verletObjList.size()); i++)
+		{
+			world.verletObjList[i].curPos = sf::Vector2f(FixedToFloat(curX[i]), FixedToFloat(curY[i]));
+			world.verletObjList[i].lastPos = sf::Vector2f(FixedToFloat(lastX[i]), FixedToFloat(lastY[i]));
+		}
+	}
+
+	uint64_t stateHash() const // FNV-1a over every position, equal hashes across builds mean equal simulations
+	{
+		uint64_t hash = 1469598103934665603ull;
+		const std::vector<fixed_t>* columns[4] = { &curX, &curY, &lastX, &lastY };
+		for (const std::vector<fixed_t>* column : columns)
+		{
+			for (fixed_t value : *column)
+			{
+				const uint32_t bits = static_cast<uint32_t>(value);
+				for (int byte = 0; byte < 4; byte++)
+				{
+					hash ^= (bits >> (byte * 8)) & 0xFF;
+					hash *= 1099511628211ull;
+				}
+			}
+		}
+		return hash;
+	}
+
+	template <class Func>
+	void forEachObjChunk(Func&& func) // func(first, last) over every ball, in parallel when there is a pool
+	{
+		ForEachChunk(threadPool, size(), objChunkSize, func);
+	}
+
+	void update() // one frame, subSteps substeps of subDt
+	{
+		for (int step = 0; step < subSteps; step++)
+		{
+			buildCollisionGrid();
+			applyBallCollisions(0);
+			applyBallCollisions(1);
+			forEachObjChunk([this](size_t first, size_t last) {
+				integrateRange(first, last);
+			});
+		}
+	}
+
+	int binCell(fixed_t position, fixed_t origin, int cells) const
+	{
+		const int64_t offset = static_cast<int64_t>(position) - origin;
+		if (offset < 0)
+			return 0;
+		return static_cast<int>(std::min<int64_t>(cells - 1, offset / cellSize));
+	}
+
+	void buildCollisionGrid()
+	{
+		grid.resetGridContent(size());
+		forEachObjChunk([this](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+			{
+				grid.addObjToCell(static_cast<uint32_t>(i), binCell(curX[i], gridOriginX, grid.width), binCell(curY[i], gridOriginY, grid.height));
+			}
+		});
+		grid.finishGridContent();
+	}
+
+	void applyBallCollisions(int stripeColour) // same stripes and cell walk as PhysSolver::applyBallCollisions
+	{
+		const CollisionStripes stripes(grid.width, collisionStripeWidth, stripeColour);
+		stripes.run(threadPool, false, [this, &stripes](size_t first, size_t last) {
+			stripes.forEachColumn(first, last, [this](int x) {
+				grid.forEachCellInColumn(x, [this](sf::Vector2i cell) {
+					CollideCell<false>(grid, cell, sf::Vector2f(), [this](uint32_t a, uint32_t b, sf::Vector2f, bool) {
+						solveContact(a, b);
+					});
+				});
+			});
+		});
+	}
+
+	void solveContact(uint32_t a, uint32_t b) // pushes two overlapping balls apart, half each
+	{
+		const fixed_t vx = curX[a] - curX[b];
+		const fixed_t vy = curY[a] - curY[b];
+		const int64_t distSq = FixedLengthSq(vx, vy);
+		if (distSq >= static_cast<int64_t>(minDist) * minDist || distSq == 0)
+			return;
+
+		const fixed_t dist = FixedSqrt64(distSq);
+		if (dist == 0)
+			return;
+
+		const fixed_t halfCorrection = FixedMul(response, minDist - dist) / 2;
+		const fixed_t dx = FixedScale(vx, halfCorrection, dist);
+		const fixed_t dy = FixedScale(vy, halfCorrection, dist);
+		curX[a] += dx;
+		curY[a] += dy;
+		curX[b] -= dx;
+		curY[b] -= dy;
+	}
+
+	void integrateRange(size_t first, size_t last) // VerletObject::updatePosition followed by the circle constraint
+	{
+		const int64_t limitSq = static_cast<int64_t>(colliderLimit) * colliderLimit;
+		for (size_t i = first; i < last; i++)
+		{
+			const fixed_t velocityX = curX[i] - lastX[i];
+			const fixed_t velocityY = curY[i] - lastY[i];
+			lastX[i] = curX[i];
+			lastY[i] = curY[i];
+			curX[i] += velocityX + gravityStepX;
+			curY[i] += velocityY + gravityStepY;
+
+			const fixed_t vx = colliderX - curX[i];
+			const fixed_t vy = colliderY - curY[i];
+			const int64_t distSq = FixedLengthSq(vx, vy);
+			if (distSq > limitSq)
+			{
+				const fixed_t dist = FixedSqrt64(distSq);
+				curX[i] = colliderX - FixedScale(vx, colliderLimit, dist);
+				curY[i] = colliderY - FixedScale(vy, colliderLimit, dist);
+			}
+		}
+	}
+};
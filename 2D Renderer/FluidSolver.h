@@ -0,0 +1,969 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// SFML includes
+#include <SFML/System.hpp>
+
+// custom includes
+#include "GridCollision.h"
+#include "PhysicsSolver.cpp"
+#include "VerletGrid.cpp"
+#include "util/thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FLUID_SOLVER_SSE2
+#endif
+
+/*
+* Position based fluid mode (Macklin & Mueller's PBF)
+* Every substep: gravity + verlet step -> grid build -> a few Jacobi iterations of the density constraint, each ending in the collider circle.
+* - the kernel radius is the grid's cell size, so every neighbour of a particle is in the 3x3 cells around it. The grid is the
+*   ball solver's VerletGrid, same layout and counting sort, loadFrom takes the world's grid as it is configured.
+* - after the build the particle columns are reordered into cell order with every grid row sorted by x, the particles of a
+*   row less than h away along x are then one contiguous window that only moves forward as the row is walked, and the
+*   neighbour loops stream through memory instead of chasing indices
+* - an iteration is two pair passes (lambda, then the position correction), each followed by a pass over the particles that
+*   turns the sums into lambda or the new position. A particle gathers its window of its own row, the pairs with its window
+*   of the row below are visited once and add to both particles, the row above came from those pairs. That loads about 16
+*   particles for the ~13 inside h, against 36 for the 3x3 cells.
+* - a row's pairs reach one row down, so stripes of grid rows run in two colours as in CollisionStripes, any thread count
+*   gives the same bits
+* - lambda is accumulated per particle into a pressure that carries over to the next substep and goes out with the first
+*   iteration's lambda (warm start, as in XPBD). Plain PBF rebuilds the pressure from scratch every substep, which needs a
+*   compression that grows with depth, and Jacobi only moves it about a kernel radius per iteration, so a deep pool sinks
+*   into itself and bounces back out unless it gets many times the iterations.
+* - the pressure only pushes apart, it is clamped at zero, so particles at a free surface don't clump into each other
+* - the collider wall counts towards the density as if rest spaced rows of particles sat behind it, otherwise particles at the
+*   wall are missing half their neighbours and the pool squeezes against it before it pushes back
+* - positions are in whatever frame they are given in, loadFrom keeps the ball solver's top left convention
+*/
+
+struct FluidSolver
+{
+	// particle state, one column per coordinate, kept in grid cell order
+	std::vector<float> curX;
+	std::vector<float> curY;
+	std::vector<float> lastX;
+	std::vector<float> lastY;
+	std::vector<uint32_t> sourceIndex; // the ball each particle was loaded from, or the addParticle order
+	std::vector<float> pressure; // accumulated lambda, <= 0, carried between substeps
+	std::vector<float> ballPressure; // pressure by ball index, kept by storeTo for the next loadFrom
+
+	// per iteration data
+	std::vector<float> lambda; // change of pressure this iteration, what the position correction applies
+
+	// pair sums, both particles of a pair add to them, the pass after reads them and leaves them at zero
+	std::vector<float> densitySum;
+	std::vector<float> gradSumX;
+	std::vector<float> gradSumY;
+	std::vector<float> gradSqSum;
+	std::vector<float> moveX;
+	std::vector<float> moveY;
+	std::vector<float> blendX; // the neighbours' velocity difference weighted by poly6 (XSPH)
+	std::vector<float> blendY;
+	std::vector<float> blendWeight;
+
+	// reorder scratch, swapped with each column in turn so a reorder never allocates once sized
+	std::vector<float> floatScratch;
+	std::vector<uint32_t> indexScratch;
+	std::vector<float> chunkMaxSpeedSq;
+
+	// broadphase
+	VerletGrid grid;
+
+	// settings
+	sf::Vector2f gravity = sf::Vector2f(0.f, 1000.f);
+	sf::Vector2f colliderCenter;
+	float colliderLimit = 300.f; // particles stay within this of colliderCenter
+	float kernelRadius = PhysSolver::obj_radius * 2.f; // h, also the grid's cell size
+	int iterations = 2; // constraint iterations per substep, Jacobi moves pressure about a kernel radius per iteration so substeps help deep pools more
+	int min_sub_steps = 8;
+	int max_sub_steps = 16;
+	float max_substep_travel = 0.5f; // kernel radii the fastest particle may move per substep before another substep is added
+	float relaxation = 1.f; // softens the constraint, as a share of the rest state's gradient sum, higher is softer but steadier
+	float warmStart = 0.5f; // share of the last substep's pressure carried into the next, above about 0.6 a settling pool overshoots and sprays
+	float viscosity = 0.1f; // XSPH, share of the velocity difference to the neighbours removed per substep
+
+	// kernel constants, from the settings by updateKernelConstants
+	float poly6Scale = 0.f; // 2D poly6 normalisation, 4 / (pi h^8)
+	float spikyGradScale = 0.f; // 2D spiky gradient normalisation, 30 / (pi h^5)
+	float restDensity = 1.f; // density of a particle in a square lattice of restSpacing()
+	float epsilon = 0.f;
+	static const int wallTableSize = 17;
+	float wallDensity[wallTableSize] = {}; // density and gradient the wall adds at wall distances 0 .. h, multiplied by the normalisations
+	float wallGradient[wallTableSize] = {};
+
+	float currentSubDt = 0.f; // substep length of the last update, scales curPos - lastPos into a velocity
+	int subSteps = 0; // substeps of the last update
+
+	// threading
+	ThreadPool* threadPool = nullptr; // optional, runs single threaded without one
+	const size_t objChunkSize = 4096;
+	const size_t rowChunkSize = 8; // grid rows per parallel task of the row sort
+	const int rowStripeWidth = 2; // grid rows per stripe of the pair passes
+
+	// every thread counts into its own slot, merged into counters once per update
+	struct CounterSlot
+	{
+		SolverCounters counters;
+		char padding[64];
+	};
+	std::vector<CounterSlot> counterSlots;
+	SolverCounters counters; // last update's work, zero without VERLET_SOLVER_COUNTERS, pairsTested counts the pair candidates of the lambda passes
+
+	size_t size() const
+	{
+		return curX.size();
+	}
+
+	float restSpacing() const // particle spacing at rest density, about 12 neighbours inside the kernel
+	{
+		return kernelRadius * 0.5f;
+	}
+
+	void configure(sf::Vector2f center, float limit, float cellSize) // a standalone domain, the collider circle and a grid just covering it
+	{
+		colliderCenter = center;
+		colliderLimit = limit;
+		kernelRadius = cellSize;
+		grid.configure(center - sf::Vector2f(limit, limit), sf::Vector2f(limit * 2.f, limit * 2.f), cellSize);
+		updateKernelConstants();
+	}
+
+	void updateKernelConstants()
+	{
+		const float pi = 3.14159265f;
+		const float h = kernelRadius;
+		poly6Scale = 4.f / (pi * std::pow(h, 8.f));
+		spikyGradScale = 30.f / (pi * std::pow(h, 5.f));
+
+		// the rest state is a square lattice at restSpacing, the sums below are what the lambda pass sees there
+		const float spacing = restSpacing();
+		float density = 0.f;
+		float gradSq = 0.f;
+		for (int a = -2; a <= 2; a++)
+		{
+			for (int b = -2; b <= 2; b++)
+			{
+				const float r = spacing * std::sqrt(static_cast<float>(a * a + b * b));
+				if (r >= h)
+					continue;
+
+				const float q2 = h * h - r * r;
+				density += poly6Scale * q2 * q2 * q2;
+				const float grad = spikyGradScale * (h - r) * (h - r);
+				if (r > 0.f)
+					gradSq += grad * grad;
+			}
+		}
+		restDensity = density;
+		epsilon = relaxation * gradSq / (restDensity * restDensity); // the neighbours' gradients cancel out at rest, so no self term
+
+		// a straight wall with rows of particles behind it at restSpacing, the first row one spacing past the wall,
+		// so a particle touching the wall in a rest spaced pool sees rest density
+		for (int k = 0; k < wallTableSize; k++)
+		{
+			const float wallDist = h * static_cast<float>(k) / static_cast<float>(wallTableSize - 1);
+			float wallSum = 0.f;
+			float wallGrad = 0.f;
+			for (int row = 1; row <= 2; row++)
+			{
+				for (int column = -2; column <= 2; column++)
+				{
+					const float along = spacing * static_cast<float>(column);
+					const float across = wallDist + spacing * static_cast<float>(row);
+					const float r = std::sqrt(along * along + across * across);
+					if (r >= h)
+						continue;
+
+					const float q2 = h * h - r * r;
+					wallSum += q2 * q2 * q2;
+					wallGrad += (h - r) * (h - r) * across / r;
+				}
+			}
+			wallDensity[k] = wallSum;
+			wallGradient[k] = wallGrad;
+		}
+	}
+
+	// the wall's part of a particle's density and of the gradient sums, in the same unscaled units as the neighbour loops.
+	// The gradient points from the wall towards the particle, like dx, dy in the loops. Zero further than h from the wall.
+	void addWallTerms(float px, float py, float& density, float& gradX, float& gradY) const
+	{
+		const float dx = px - colliderCenter.x;
+		const float dy = py - colliderCenter.y;
+		const float centerDist = std::sqrt(dx * dx + dy * dy);
+		const float wallDist = colliderLimit - centerDist;
+		if (wallDist >= kernelRadius || centerDist <= 0.f)
+			return;
+
+		const float at = std::max(wallDist, 0.f) / kernelRadius * static_cast<float>(wallTableSize - 1);
+		const int k = std::min(static_cast<int>(at), wallTableSize - 2);
+		const float t = at - static_cast<float>(k);
+		const float wallGrad = wallGradient[k] + (wallGradient[k + 1] - wallGradient[k]) * t;
+		density += wallDensity[k] + (wallDensity[k + 1] - wallDensity[k]) * t;
+		gradX -= wallGrad * dx / centerDist; // the wall is outwards from the centre
+		gradY -= wallGrad * dy / centerDist;
+	}
+
+	void clear()
+	{
+		curX.clear();
+		curY.clear();
+		lastX.clear();
+		lastY.clear();
+		sourceIndex.clear();
+		pressure.clear();
+	}
+
+	void addParticle(sf::Vector2f pos, sf::Vector2f velocity = sf::Vector2f()) // velocity in px/s, needs currentSubDt set to carry one
+	{
+		curX.push_back(pos.x);
+		curY.push_back(pos.y);
+		lastX.push_back(pos.x - velocity.x * currentSubDt);
+		lastY.push_back(pos.y - velocity.y * currentSubDt);
+		sourceIndex.push_back(static_cast<uint32_t>(sourceIndex.size()));
+		pressure.push_back(0.f);
+	}
+
+	void loadFrom(const PhysSolver& world) // every ball becomes a particle, on the world's grid, collider and gravity
+	{
+		grid.configure(world.verletScreenGrid.origin, sf::Vector2f(world.verletScreenGrid.width * world.verletScreenGrid.cellSize, world.verletScreenGrid.height * world.verletScreenGrid.cellSize), world.verletScreenGrid.cellSize);
+		kernelRadius = grid.cellSize;
+		updateKernelConstants();
+		colliderCenter = world.collider_pos - sf::Vector2f(world.obj_radius, world.obj_radius); // positions are the top left of a ball
+		colliderLimit = world.collider_radius - world.obj_radius;
+		gravity = world.gravity;
+		currentSubDt = world.currentSubDt;
+
+		const size_t count = world.verletObjList.size();
+		curX.resize(count);
+		curY.resize(count);
+		lastX.resize(count);
+		lastY.resize(count);
+		sourceIndex.resize(count);
+		pressure.resize(count);
+		const bool samePressures = ballPressure.size() == count; // balls added or removed since storeTo start from zero
+		for (size_t i = 0; i < count; i++)
+		{
+			const VerletObject& obj = world.verletObjList[i];
+			curX[i] = obj.curPos.x;
+			curY[i] = obj.curPos.y;
+			lastX[i] = obj.lastPos.x;
+			lastY[i] = obj.lastPos.y;
+			sourceIndex[i] = static_cast<uint32_t>(i);
+			pressure[i] = samePressures ? ballPressure[i] : 0.f;
+		}
+	}
+
+	void storeTo(PhysSolver& world) // writes the particles back into the balls they were loaded from
+	{
+		world.currentSubDt = currentSubDt;
+		ballPressure.assign(world.verletObjList.size(), 0.f);
+		for (size_t i = 0; i < size(); i++)
+		{
+			if (sourceIndex[i] >= world.verletObjList.size())
+				continue;
+
+			ballPressure[sourceIndex[i]] = pressure[i];
+
+			VerletObject& obj = world.verletObjList[sourceIndex[i]];
+			obj.curPos = sf::Vector2f(curX[i], curY[i]);
+			obj.lastPos = sf::Vector2f(lastX[i], lastY[i]);
+		}
+		world.gridDirty = true; // the world's own grid no longer matches
+	}
+
+	// appends the balls added to the world since the last loadFrom or storeTo, the particles already there keep their order.
+	// Only for a world that grew at the end, anything that removed or moved balls needs a loadFrom.
+	void addBallsFrom(const PhysSolver& world)
+	{
+		for (size_t i = size(); i < world.verletObjList.size(); i++)
+		{
+			const VerletObject& obj = world.verletObjList[i];
+			curX.push_back(obj.curPos.x);
+			curY.push_back(obj.curPos.y);
+			lastX.push_back(obj.lastPos.x);
+			lastY.push_back(obj.lastPos.y);
+			sourceIndex.push_back(static_cast<uint32_t>(i));
+			pressure.push_back(0.f);
+		}
+	}
+
+	uint64_t stateHash() const // FNV-1a over every position, in cell order
+	{
+		uint64_t hash = 1469598103934665603ull;
+		const std::vector<float>* columns[4] = { &curX, &curY, &lastX, &lastY };
+		for (const std::vector<float>* column : columns)
+		{
+			for (float value : *column)
+			{
+				uint32_t bits;
+				std::memcpy(&bits, &value, sizeof(bits));
+				for (int byte = 0; byte < 4; byte++)
+				{
+					hash ^= (bits >> (byte * 8)) & 0xFF;
+					hash *= 1099511628211ull;
+				}
+			}
+		}
+		return hash;
+	}
+
+	template <class Func>
+	void forEachObjChunk(Func&& func) // func(first, last) over every particle, in parallel when there is a pool
+	{
+		if (threadPool)
+			threadPool->parallelFor(0, size(), objChunkSize, func);
+		else
+			func(0, size());
+	}
+
+	template <class Func>
+	void forEachRowChunk(Func&& func) // func(firstRow, lastRow) over the grid rows
+	{
+		if (threadPool)
+			threadPool->parallelFor(0, static_cast<size_t>(grid.height), rowChunkSize, func);
+		else
+			func(0, static_cast<size_t>(grid.height));
+	}
+
+	template <class RowPass>
+	void forEachPairRow(RowPass&& rowPass) // rowPass(y, counters) over every grid row, stripes of rows in two colours so rows reaching into the next one never overlap
+	{
+		for (int colour = 0; colour < 2; colour++)
+		{
+			const CollisionStripes stripes(grid.height, rowStripeWidth, colour); // the stripes' columns are grid rows here
+			stripes.run(threadPool, false, [this, &stripes, &rowPass](size_t first, size_t last) {
+				SolverCounters& rowCounters = localCounters();
+				stripes.forEachColumn(first, last, [&rowPass, &rowCounters](int y) {
+					rowPass(y, rowCounters);
+				});
+			});
+		}
+	}
+
+	SolverCounters& localCounters()
+	{
+		return counterSlots[threadPool ? threadPool->currentThreadSlot() : 0].counters;
+	}
+
+	void update(float dt)
+	{
+		const int steps = chooseSubSteps(dt);
+		const float sub_dt = dt / static_cast<float>(steps);
+		if (currentSubDt > 0.f && sub_dt != currentSubDt) // same as PhysSolver, the velocity lives in curPos - lastPos
+			rescaleVelocities(sub_dt / currentSubDt);
+		currentSubDt = sub_dt;
+
+		const size_t slotCount = threadPool ? threadPool->getThreadCount() + 1 : 1;
+		counterSlots.resize(std::max(counterSlots.size(), slotCount));
+		SOLVER_COUNT(for (CounterSlot& slot : counterSlots) slot.counters = SolverCounters();)
+
+		lambda.resize(size());
+		std::vector<float>* sums[9] = { &densitySum, &gradSumX, &gradSumY, &gradSqSum, &moveX, &moveY, &blendX, &blendY, &blendWeight };
+		for (std::vector<float>* sum : sums)
+		{
+			sum->assign(size(), 0.f);
+		}
+
+		for (int step = 0; step < steps; step++)
+		{
+			forEachObjChunk([this, sub_dt](size_t first, size_t last) {
+				integrateRange(first, last, sub_dt, localCounters());
+			});
+
+			buildCollisionGrid();
+
+			for (int iteration = 0; iteration < iterations; iteration++)
+			{
+				solveDensity(iteration == 0);
+				if (iteration + 1 < iterations || viscosity <= 0.f)
+					correctPositions<false>();
+				else // the last iteration also evens out the velocities
+					correctPositions<true>();
+			}
+		}
+
+		counters = SolverCounters();
+		SOLVER_COUNT(for (const CounterSlot& slot : counterSlots) counters.merge(slot.counters);)
+	}
+
+	int chooseSubSteps(float dt) // PhysSolver::chooseSubSteps with the kernel radius as the yardstick
+	{
+		float maxSpeedSq = 0.f;
+		if (currentSubDt > 0.f && size() > 0)
+		{
+			chunkMaxSpeedSq.assign((size() + objChunkSize - 1) / objChunkSize, 0.f);
+			forEachObjChunk([this](size_t first, size_t last) {
+				float chunkMax = 0.f;
+				for (size_t i = first; i < last; i++)
+				{
+					const float vx = curX[i] - lastX[i];
+					const float vy = curY[i] - lastY[i];
+					chunkMax = std::max(chunkMax, vx * vx + vy * vy);
+				}
+				chunkMaxSpeedSq[first / objChunkSize] = chunkMax;
+			});
+
+			for (float chunkMax : chunkMaxSpeedSq)
+			{
+				maxSpeedSq = std::max(maxSpeedSq, chunkMax);
+			}
+			maxSpeedSq /= currentSubDt * currentSubDt;
+		}
+
+		const int wanted = static_cast<int>(std::ceil(std::sqrt(maxSpeedSq) * dt / (max_substep_travel * kernelRadius)));
+		subSteps = std::min(max_sub_steps, std::max(min_sub_steps, wanted));
+		return subSteps;
+	}
+
+	void rescaleVelocities(float ratio)
+	{
+		forEachObjChunk([this, ratio](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+			{
+				lastX[i] = curX[i] - (curX[i] - lastX[i]) * ratio;
+				lastY[i] = curY[i] - (curY[i] - lastY[i]) * ratio;
+			}
+		});
+	}
+
+	void integrateRange(size_t first, size_t last, float sub_dt, [[maybe_unused]] SolverCounters& threadCounters) // the prediction step
+	{
+		const float gravityStepX = gravity.x * sub_dt * sub_dt;
+		const float gravityStepY = gravity.y * sub_dt * sub_dt;
+		const float maxStepSq = kernelRadius * kernelRadius; // past the substep cap, a kernel radius per substep keeps the neighbour search valid
+		for (size_t i = first; i < last; i++)
+		{
+			float vx = curX[i] - lastX[i];
+			float vy = curY[i] - lastY[i];
+			const float stepSq = vx * vx + vy * vy;
+			if (stepSq > maxStepSq)
+			{
+				const float scale = kernelRadius / std::sqrt(stepSq);
+				vx *= scale;
+				vy *= scale;
+			}
+
+			lastX[i] = curX[i];
+			lastY[i] = curY[i];
+			curX[i] += vx + gravityStepX;
+			curY[i] += vy + gravityStepY;
+			constrainToCollider(curX[i], curY[i], threadCounters);
+		}
+	}
+
+	void constrainToCollider(float& x, float& y, [[maybe_unused]] SolverCounters& threadCounters) const
+	{
+		const float dx = x - colliderCenter.x;
+		const float dy = y - colliderCenter.y;
+		const float distSq = dx * dx + dy * dy;
+		if (distSq > colliderLimit * colliderLimit)
+		{
+			const float scale = colliderLimit / std::sqrt(distSq);
+			x = colliderCenter.x + dx * scale;
+			y = colliderCenter.y + dy * scale;
+			SOLVER_COUNT(threadCounters.boundaryHits++;)
+		}
+	}
+
+	void buildCollisionGrid() // bins every particle, then reorders the columns into cell order
+	{
+		grid.resetGridContent(size());
+		forEachObjChunk([this](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+			{
+				grid.addObjToGrid(sf::Vector2f(curX[i], curY[i]), static_cast<uint32_t>(i));
+			}
+		});
+		grid.finishGridContent();
+
+		// cells are in x order along a row, sorting each cell by x sorts the whole row. The particles kept their order from
+		// the last build, so a cell is nearly sorted already and an insertion sort only moves the few that overtook another.
+		// Right after loadFrom a cell is in ball order instead, still cheap since nothing moves past the start of its cell.
+		forEachRowChunk([this](size_t firstRow, size_t lastRow) {
+			uint32_t* objects = grid.cellObjects.data();
+			for (size_t y = firstRow; y < lastRow; y++)
+			{
+				for (uint32_t k = grid.cellStart[y * grid.width]; k < grid.cellStart[(y + 1) * grid.width]; k++)
+				{
+					const uint32_t obj = objects[k];
+					uint32_t at = k;
+					for (; at > grid.cellStart[y * grid.width] && curX[objects[at - 1]] > curX[obj]; at--)
+					{
+						objects[at] = objects[at - 1];
+					}
+					objects[at] = obj;
+				}
+			}
+		});
+
+		// particle k becomes cellObjects[k], after which cell c holds particles cellStart[c] .. cellStart[c + 1]
+		floatScratch.resize(size());
+		indexScratch.resize(size());
+		std::vector<float>* columns[5] = { &curX, &curY, &lastX, &lastY, &pressure };
+		for (std::vector<float>* column : columns)
+		{
+			forEachObjChunk([this, column](size_t first, size_t last) {
+				for (size_t k = first; k < last; k++)
+				{
+					floatScratch[k] = (*column)[grid.cellObjects[k]];
+				}
+			});
+			column->swap(floatScratch);
+		}
+		forEachObjChunk([this](size_t first, size_t last) {
+			for (size_t k = first; k < last; k++)
+			{
+				indexScratch[k] = sourceIndex[grid.cellObjects[k]];
+			}
+		});
+		sourceIndex.swap(indexScratch);
+	}
+
+	struct NeighbourRuns // the particles of the 3x3 cells around a cell, one contiguous run per grid row
+	{
+		uint32_t begin[3];
+		uint32_t end[3];
+		int count = 0;
+	};
+
+	NeighbourRuns neighbourRuns(int x, int y) const
+	{
+		NeighbourRuns runs;
+		const int x0 = std::max(x - 1, 0);
+		const int x1 = std::min(x + 1, grid.width - 1);
+		for (int ny = std::max(y - 1, 0); ny <= std::min(y + 1, grid.height - 1); ny++)
+		{
+			const size_t rowStart = static_cast<size_t>(ny) * grid.width;
+			runs.begin[runs.count] = grid.cellStart[rowStart + x0];
+			runs.end[runs.count] = grid.cellStart[rowStart + x1 + 1];
+			runs.count++;
+		}
+		return runs;
+	}
+
+	struct RowWindow // the particles of one grid row less than h away along x, rows are sorted by x so it only moves forward
+	{
+		uint32_t begin = 0;
+		uint32_t end = 0;
+		uint32_t rowEnd = 0;
+
+		RowWindow(const VerletGrid& grid, int y)
+		{
+			if (y < grid.height)
+			{
+				begin = grid.cellStart[static_cast<size_t>(y) * grid.width];
+				rowEnd = grid.cellStart[static_cast<size_t>(y + 1) * grid.width];
+			}
+			end = begin;
+		}
+
+		void moveTo(const std::vector<float>& x, float from, float to) // from, to must not decrease between calls
+		{
+			for (; begin < rowEnd && x[begin] <= from; begin++);
+			end = std::max(end, begin);
+			for (; end < rowEnd && x[end] < to; end++);
+		}
+	};
+
+#ifdef FLUID_SOLVER_SSE2
+	static float horizontalSum(__m128 v)
+	{
+		const __m128 pairs = _mm_add_ps(v, _mm_movehl_ps(v, v));
+		return _mm_cvtss_f32(_mm_add_ss(pairs, _mm_shuffle_ps(pairs, pairs, 1)));
+	}
+
+	static void addTo(std::vector<float>& sum, uint32_t j, __m128 v) // sum[j .. j + 3] += v
+	{
+		_mm_storeu_ps(&sum[j], _mm_add_ps(_mm_loadu_ps(&sum[j]), v));
+	}
+
+	static void subtractFrom(std::vector<float>& sum, uint32_t j, __m128 v)
+	{
+		_mm_storeu_ps(&sum[j], _mm_sub_ps(_mm_loadu_ps(&sum[j]), v));
+	}
+
+	static __m128 runLanes(uint32_t block, uint32_t first, uint32_t self) // all bits set in the lanes of block .. block + 3 from first on, except self
+	{
+		const __m128i lanes = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(block)), _mm_setr_epi32(0, 1, 2, 3));
+		const __m128i fresh = _mm_cmpgt_epi32(lanes, _mm_set1_epi32(static_cast<int>(first) - 1));
+		return _mm_castsi128_ps(_mm_andnot_si128(_mm_cmpeq_epi32(lanes, _mm_set1_epi32(static_cast<int>(self))), fresh));
+	}
+#endif
+
+	void solveDensity(bool firstIteration) // one lambda pass, the pair sums then lambda and pressure per particle
+	{
+		forEachPairRow([this](int y, [[maybe_unused]] SolverCounters& threadCounters) {
+			sumDensityRow(y, threadCounters);
+		});
+		forEachObjChunk([this, firstIteration](size_t first, size_t last) {
+			finishDensity(first, last, firstIteration);
+		});
+	}
+
+	template <bool Viscosity>
+	void correctPositions() // one position correction from the current lambda, the pair sums then the move per particle
+	{
+		forEachPairRow([this](int y, [[maybe_unused]] SolverCounters& threadCounters) {
+			sumCorrectionRow<Viscosity>(y, threadCounters);
+		});
+		forEachObjChunk([this](size_t first, size_t last) {
+			finishCorrection<Viscosity>(first, last, localCounters());
+		});
+	}
+
+	// the density and constraint gradient sums of the particles in row y. A particle takes its own row from both sides, the way
+	// a full gather would, and the row below as pairs that add to both particles, the row above then came from its pairs.
+	// Only the row below is written, so a particle's own sum is never stored just before a neighbour loads it 4 wide.
+	void sumDensityRow(int y, [[maybe_unused]] SolverCounters& threadCounters)
+	{
+		const float h = kernelRadius;
+		RowWindow row(grid, y);
+		RowWindow below(grid, y + 1);
+		const uint32_t rowBegin = row.begin;
+		for (uint32_t i = rowBegin; i < row.rowEnd; i++)
+		{
+			row.moveTo(curX, curX[i] - h, curX[i] + h);
+			below.moveTo(curX, curX[i] - h, curX[i] + h);
+			SOLVER_COUNT(threadCounters.pairsTested += row.end - row.begin + below.end - below.begin;)
+			float density = 0.f;
+			float gradX = 0.f;
+			float gradY = 0.f;
+			float gradSq = 0.f;
+			sumDensityRun<false>(i, row.begin, row.end, density, gradX, gradY, gradSq);
+			sumDensityRun<true>(i, below.begin, below.end, density, gradX, gradY, gradSq);
+
+			densitySum[i] += density;
+			gradSumX[i] += gradX;
+			gradSumY[i] += gradY;
+			gradSqSum[i] += gradSq;
+		}
+	}
+
+	// particle i's kernel sums over particles [begin, end), with Mirror also added to theirs. The sums have no branch on the
+	// distance, a particle further than h adds zero, so runs go 4 at a time with SSE2, the last 4 overlapping the ones before.
+	// i itself is skipped, its own term is added in the finish pass, the window may not cover it once particles have moved.
+	template <bool Mirror>
+	void sumDensityRun(uint32_t i, uint32_t begin, uint32_t end, float& density, float& gradX, float& gradY, float& gradSq)
+	{
+		const float h = kernelRadius;
+		const float hSq = h * h;
+		const float px = curX[i];
+		const float py = curY[i];
+		uint32_t j = begin;
+#ifdef FLUID_SOLVER_SSE2
+		const __m128 vPx = _mm_set1_ps(px), vPy = _mm_set1_ps(py);
+		const __m128 vH = _mm_set1_ps(h), vHSq = _mm_set1_ps(hSq);
+		const __m128 vZero = _mm_setzero_ps(), vOne = _mm_set1_ps(1.f);
+		__m128 vDensity = vZero, vGradX = vZero, vGradY = vZero, vGradSq = vZero;
+		for (; j < end && end - begin >= 4; j += 4) // a run shorter than 4 goes one at a time
+		{
+			const uint32_t block = std::min(j, end - 4); // the last block ends on the run's end, lanes before j were done already
+			const __m128 fresh = runLanes(block, j, i);
+			const __m128 dx = _mm_sub_ps(vPx, _mm_loadu_ps(&curX[block]));
+			const __m128 dy = _mm_sub_ps(vPy, _mm_loadu_ps(&curY[block]));
+			const __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			const __m128 q2 = _mm_and_ps(fresh, _mm_max_ps(_mm_sub_ps(vHSq, distSq), vZero));
+			const __m128 w = _mm_mul_ps(_mm_mul_ps(q2, q2), q2);
+
+			const __m128 dist = _mm_sqrt_ps(distSq);
+			const __m128 q = _mm_max_ps(_mm_sub_ps(vH, dist), vZero);
+			const __m128 invDist = _mm_and_ps(_mm_and_ps(fresh, _mm_cmpgt_ps(dist, vZero)), _mm_div_ps(vOne, dist));
+			const __m128 grad = _mm_mul_ps(_mm_mul_ps(q, q), invDist);
+			const __m128 gx = _mm_mul_ps(grad, dx);
+			const __m128 gy = _mm_mul_ps(grad, dy);
+			const __m128 gSq = _mm_mul_ps(_mm_mul_ps(grad, grad), distSq);
+			vDensity = _mm_add_ps(vDensity, w);
+			vGradX = _mm_add_ps(vGradX, gx);
+			vGradY = _mm_add_ps(vGradY, gy);
+			vGradSq = _mm_add_ps(vGradSq, gSq);
+			if (Mirror)
+			{
+				addTo(densitySum, block, w);
+				subtractFrom(gradSumX, block, gx); // the gradient is the other way round for j
+				subtractFrom(gradSumY, block, gy);
+				addTo(gradSqSum, block, gSq);
+			}
+		}
+		density += horizontalSum(vDensity);
+		gradX += horizontalSum(vGradX);
+		gradY += horizontalSum(vGradY);
+		gradSq += horizontalSum(vGradSq);
+#endif
+		for (; j < end; j++)
+		{
+			if (!Mirror && j == i)
+				continue;
+
+			const float dx = px - curX[j];
+			const float dy = py - curY[j];
+			const float distSq = dx * dx + dy * dy;
+			const float q2 = std::max(hSq - distSq, 0.f);
+			const float w = q2 * q2 * q2;
+
+			const float dist = std::sqrt(distSq);
+			const float q = std::max(h - dist, 0.f);
+			const float invDist = dist > 0.f ? 1.f / dist : 0.f; // particles on the same spot have no gradient between them
+			const float grad = q * q * invDist;
+			const float gSq = grad * grad * distSq;
+			density += w;
+			gradX += grad * dx;
+			gradY += grad * dy;
+			gradSq += gSq;
+			if (Mirror)
+			{
+				densitySum[j] += w;
+				gradSumX[j] -= grad * dx;
+				gradSumY[j] -= grad * dy;
+				gradSqSum[j] += gSq;
+			}
+		}
+	}
+
+	// lambda and pressure of particles [first, last) from the pair sums. The first iteration of a substep scales the pressure
+	// carried over from the last substep by warmStart and puts it into lambda as well, it goes out together with its own change.
+	void finishDensity(size_t first, size_t last, bool firstIteration)
+	{
+		const float gradScaleSq = spikyGradScale * spikyGradScale / (restDensity * restDensity);
+		const float hSq = kernelRadius * kernelRadius;
+		const float selfDensity = hSq * hSq * hSq; // the particle's own poly6 term, the pair passes skip it
+		for (size_t i = first; i < last; i++)
+		{
+			float density = densitySum[i] + selfDensity;
+			float gradX = gradSumX[i];
+			float gradY = gradSumY[i];
+			const float gradSq = gradSqSum[i];
+			densitySum[i] = 0.f;
+			gradSumX[i] = 0.f;
+			gradSumY[i] = 0.f;
+			gradSqSum[i] = 0.f;
+
+			addWallTerms(curX[i], curY[i], density, gradX, gradY); // the wall doesn't move, so it only adds to the particle's own gradient
+			// below rest density the change is positive and lets the pressure go back towards zero, never past it
+			const float constraint = density * poly6Scale / restDensity - 1.f;
+			const float carried = firstIteration ? pressure[i] * warmStart : pressure[i];
+			const float accumulated = std::min(0.f, carried - constraint / (gradScaleSq * (gradSq + gradX * gradX + gradY * gradY) + epsilon));
+			lambda[i] = firstIteration ? accumulated : accumulated - carried;
+			pressure[i] = accumulated;
+		}
+	}
+
+	// the position correction sums of the particles in row y from both lambdas, split into windows like sumDensityRow. With
+	// Viscosity also the velocity differences that blend a particle's velocity towards its neighbours' (XSPH).
+	template <bool Viscosity>
+	void sumCorrectionRow(int y, [[maybe_unused]] SolverCounters& threadCounters)
+	{
+		const float h = kernelRadius;
+		RowWindow row(grid, y);
+		RowWindow below(grid, y + 1);
+		const uint32_t rowBegin = row.begin;
+		for (uint32_t i = rowBegin; i < row.rowEnd; i++)
+		{
+			row.moveTo(curX, curX[i] - h, curX[i] + h);
+			below.moveTo(curX, curX[i] - h, curX[i] + h);
+			float sums[5] = {}; // move x, y, blend x, y, blend weight
+			sumCorrectionRun<Viscosity, false>(i, row.begin, row.end, sums);
+			sumCorrectionRun<Viscosity, true>(i, below.begin, below.end, sums);
+
+			moveX[i] += sums[0];
+			moveY[i] += sums[1];
+			if (Viscosity)
+			{
+				blendX[i] += sums[2];
+				blendY[i] += sums[3];
+				blendWeight[i] += sums[4];
+			}
+		}
+	}
+
+	template <bool Viscosity, bool Mirror>
+	void sumCorrectionRun(uint32_t i, uint32_t begin, uint32_t end, float (&sums)[5])
+	{
+		const float h = kernelRadius;
+		const float hSq = h * h;
+		const float px = curX[i];
+		const float py = curY[i];
+		const float lambdaI = lambda[i];
+		const float velocityX = px - lastX[i];
+		const float velocityY = py - lastY[i];
+		uint32_t j = begin;
+#ifdef FLUID_SOLVER_SSE2
+		const __m128 vPx = _mm_set1_ps(px), vPy = _mm_set1_ps(py);
+		const __m128 vH = _mm_set1_ps(h), vHSq = _mm_set1_ps(hSq);
+		const __m128 vZero = _mm_setzero_ps(), vOne = _mm_set1_ps(1.f);
+		const __m128 vLambdaI = _mm_set1_ps(lambdaI);
+		const __m128 vVelocityX = _mm_set1_ps(velocityX), vVelocityY = _mm_set1_ps(velocityY);
+		__m128 vMoveX = vZero, vMoveY = vZero, vBlendX = vZero, vBlendY = vZero, vBlendWeight = vZero;
+		for (; j < end && end - begin >= 4; j += 4) // a run shorter than 4 goes one at a time
+		{
+			const uint32_t block = std::min(j, end - 4); // as in sumDensityRun
+			const __m128 fresh = runLanes(block, j, i);
+			const __m128 otherX = _mm_loadu_ps(&curX[block]);
+			const __m128 otherY = _mm_loadu_ps(&curY[block]);
+			const __m128 dx = _mm_sub_ps(vPx, otherX);
+			const __m128 dy = _mm_sub_ps(vPy, otherY);
+			const __m128 distSq = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+			const __m128 dist = _mm_sqrt_ps(distSq);
+			const __m128 q = _mm_max_ps(_mm_sub_ps(vH, dist), vZero);
+			const __m128 invDist = _mm_and_ps(_mm_and_ps(fresh, _mm_cmpgt_ps(dist, vZero)), _mm_div_ps(vOne, dist));
+			const __m128 weight = _mm_mul_ps(_mm_add_ps(vLambdaI, _mm_loadu_ps(&lambda[block])), _mm_mul_ps(_mm_mul_ps(q, q), invDist));
+			const __m128 mx = _mm_mul_ps(weight, dx);
+			const __m128 my = _mm_mul_ps(weight, dy);
+			vMoveX = _mm_add_ps(vMoveX, mx);
+			vMoveY = _mm_add_ps(vMoveY, my);
+			if (Mirror)
+			{
+				subtractFrom(moveX, block, mx);
+				subtractFrom(moveY, block, my);
+			}
+			if (Viscosity)
+			{
+				const __m128 q2 = _mm_and_ps(fresh, _mm_max_ps(_mm_sub_ps(vHSq, distSq), vZero));
+				const __m128 w = _mm_mul_ps(_mm_mul_ps(q2, q2), q2);
+				const __m128 bx = _mm_mul_ps(w, _mm_sub_ps(_mm_sub_ps(otherX, _mm_loadu_ps(&lastX[block])), vVelocityX));
+				const __m128 by = _mm_mul_ps(w, _mm_sub_ps(_mm_sub_ps(otherY, _mm_loadu_ps(&lastY[block])), vVelocityY));
+				vBlendX = _mm_add_ps(vBlendX, bx);
+				vBlendY = _mm_add_ps(vBlendY, by);
+				vBlendWeight = _mm_add_ps(vBlendWeight, w);
+				if (Mirror)
+				{
+					subtractFrom(blendX, block, bx);
+					subtractFrom(blendY, block, by);
+					addTo(blendWeight, block, w);
+				}
+			}
+		}
+		sums[0] += horizontalSum(vMoveX);
+		sums[1] += horizontalSum(vMoveY);
+		if (Viscosity)
+		{
+			sums[2] += horizontalSum(vBlendX);
+			sums[3] += horizontalSum(vBlendY);
+			sums[4] += horizontalSum(vBlendWeight);
+		}
+#endif
+		for (; j < end; j++)
+		{
+			if (!Mirror && j == i)
+				continue;
+
+			const float dx = px - curX[j];
+			const float dy = py - curY[j];
+			const float distSq = dx * dx + dy * dy;
+			const float dist = std::sqrt(distSq);
+			const float q = std::max(h - dist, 0.f);
+			const float invDist = dist > 0.f ? 1.f / dist : 0.f;
+			const float weight = (lambdaI + lambda[j]) * q * q * invDist;
+			sums[0] += weight * dx;
+			sums[1] += weight * dy;
+			if (Mirror)
+			{
+				moveX[j] -= weight * dx;
+				moveY[j] -= weight * dy;
+			}
+			if (Viscosity)
+			{
+				const float q2 = std::max(hSq - distSq, 0.f);
+				const float w = q2 * q2 * q2;
+				const float bx = w * (curX[j] - lastX[j] - velocityX);
+				const float by = w * (curY[j] - lastY[j] - velocityY);
+				sums[2] += bx;
+				sums[3] += by;
+				sums[4] += w;
+				if (Mirror)
+				{
+					blendX[j] -= bx;
+					blendY[j] -= by;
+					blendWeight[j] += w;
+				}
+			}
+		}
+	}
+
+	template <bool Viscosity>
+	void finishCorrection(size_t first, size_t last, [[maybe_unused]] SolverCounters& threadCounters) // moves particles [first, last) by the pair sums, then the collider
+	{
+		const float correctionScale = spikyGradScale / restDensity;
+		const float hSq = kernelRadius * kernelRadius;
+		const float selfWeight = hSq * hSq * hSq; // the particle's own blend weight, the pair passes skip it
+		for (size_t i = first; i < last; i++)
+		{
+			const float px = curX[i];
+			const float py = curY[i];
+			float sumX = moveX[i];
+			float sumY = moveY[i];
+			moveX[i] = 0.f;
+			moveY[i] = 0.f;
+
+			// the wall's rows act as mirror images of the particle, lambda i + lambda i
+			float wallDensityUnused = 0.f;
+			float wallX = 0.f;
+			float wallY = 0.f;
+			addWallTerms(px, py, wallDensityUnused, wallX, wallY);
+			sumX += 2.f * lambda[i] * wallX;
+			sumY += 2.f * lambda[i] * wallY;
+
+			// lambda is negative where compressed, so this pushes away from the neighbours
+			float newX = px - correctionScale * sumX;
+			float newY = py - correctionScale * sumY;
+			if (Viscosity) // with the particle's own weight the divisor is never zero
+			{
+				const float weight = blendWeight[i] + selfWeight;
+				newX += viscosity * blendX[i] / weight;
+				newY += viscosity * blendY[i] / weight;
+				blendX[i] = 0.f;
+				blendY[i] = 0.f;
+				blendWeight[i] = 0.f;
+			}
+			constrainToCollider(newX, newY, threadCounters);
+			curX[i] = newX;
+			curY[i] = newY;
+		}
+	}
+
+	void densityError(float& maxError, float& meanError) const // how far above rest density the particles are, as a share of it, serial
+	{
+		const float hSq = kernelRadius * kernelRadius;
+		maxError = 0.f;
+		double sum = 0.0;
+		for (int y = 0; y < grid.height; y++)
+		{
+			for (int x = 0; x < grid.width; x++)
+			{
+				const size_t cell = static_cast<size_t>(y) * grid.width + x;
+				const NeighbourRuns runs = neighbourRuns(x, y);
+				for (uint32_t i = grid.cellStart[cell]; i < grid.cellStart[cell + 1]; i++)
+				{
+					float density = 0.f;
+					for (int run = 0; run < runs.count; run++)
+					{
+						for (uint32_t j = runs.begin[run]; j < runs.end[run]; j++)
+						{
+							const float dx = curX[i] - curX[j];
+							const float dy = curY[i] - curY[j];
+							const float q2 = std::max(hSq - dx * dx - dy * dy, 0.f);
+							density += q2 * q2 * q2;
+						}
+					}
+
+					float gradX = 0.f;
+					float gradY = 0.f;
+					addWallTerms(curX[i], curY[i], density, gradX, gradY);
+					const float error = std::max(0.f, density * poly6Scale / restDensity - 1.f);
+					maxError = std::max(maxError, error);
+					sum += error;
+				}
+			}
+		}
+		meanError = size() > 0 ? static_cast<float>(sum / static_cast<double>(size())) : 0.f;
+	}
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// SFML includes
+#include <SFML/Graphics.hpp>
+
+// custom includes
+#include "util/alloc_tracker.h"
+
+/*
+* Asynchronous frame export
+* - the render thread copies a finished frame into a pooled buffer and queues it, nothing else. submitWith lets it read
+*   the frame straight into the buffer, e.g. glReadPixels, so a frame costs one copy and no allocation once the pool is sized
+* - encoder threads turn queued frames into a PNG sequence or a raw Y4M video
+* - the queue is bounded, when it is full the policy either blocks the caller or drops the frame
+*/
+
+enum class ExportFormat
+{
+	PngSequence, // <prefix>_000001.png, <prefix>_000002.png, ...
+	Y4M // <prefix>.y4m, 4:2:0, written in order by a single encoder
+};
+
+enum class ExportPolicy
+{
+	Block, // backpressure, the render loop waits for a free slot
+	DropNewest // never waits, frames that don't fit are counted and skipped
+};
+
+class FrameExporter
+{
+private:
+	struct ExportFrame
+	{
+		std::vector<sf::Uint8> rgba;
+		unsigned int width = 0;
+		unsigned int height = 0;
+		bool bottomUp = false; // rows stored last row first, as OpenGL reads them back
+		size_t frameNumber = 0;
+
+		const sf::Uint8* row(unsigned int y) const // row y counted from the top
+		{
+			return &this->rgba[static_cast<size_t>(this->bottomUp ? this->height - 1 - y : y) * this->width * 4];
+		}
+	};
+
+	ExportFormat format = ExportFormat::PngSequence;
+	ExportPolicy policy = ExportPolicy::DropNewest;
+	std::string outputPrefix;
+	size_t queueCapacity = 8;
+
+	std::mutex queueLock;
+	std::condition_variable frameQueued; // encoders wait on this
+	std::condition_variable slotFreed; // a blocked render thread waits on this
+	std::deque<ExportFrame*> queuedFrames;
+	std::vector<ExportFrame*> freeFrames; // buffers reused so steady state capture doesn't allocate
+	std::vector<ExportFrame> framePool;
+	bool stopping = false;
+
+	std::vector<std::thread> encoders;
+	std::FILE* videoFile = nullptr;
+	std::vector<sf::Uint8> yuvPlanes; // only touched by the single Y4M encoder
+
+	size_t nextFrameNumber = 0;
+	std::atomic<size_t> framesWritten{ 0 };
+	std::atomic<size_t> framesDropped{ 0 };
+
+	void encoderLoop()
+	{
+		AllocTracker::ignoreThisThread(); // encoding runs beside the frame, its allocations aren't the loop's
+
+		while (true)
+		{
+			ExportFrame* frame = nullptr;
+			{
+				std::unique_lock<std::mutex> guard(this->queueLock);
+				this->frameQueued.wait(guard, [this] { return this->stopping || !this->queuedFrames.empty(); });
+				if (this->queuedFrames.empty()) // stopping and drained
+					return;
+
+				frame = this->queuedFrames.front();
+				this->queuedFrames.pop_front();
+			}
+
+			if (this->format == ExportFormat::PngSequence)
+				this->writePng(*frame);
+			else
+				this->writeY4MFrame(*frame);
+			this->framesWritten.fetch_add(1);
+
+			{
+				std::lock_guard<std::mutex> guard(this->queueLock);
+				this->freeFrames.push_back(frame);
+			}
+			this->slotFreed.notify_one();
+		}
+	}
+
+	void writePng(const ExportFrame& frame)
+	{
+		char path[512];
+		std::snprintf(path, sizeof(path), "%s_%06zu.png", this->outputPrefix.c_str(), frame.frameNumber);
+
+		sf::Image image;
+		image.create(frame.width, frame.height, frame.rgba.data());
+		if (frame.bottomUp)
+			image.flipVertically();
+		if (!image.saveToFile(path))
+			std::cout << "Error writing " << path << "\n";
+	}
+
+	void writeY4MFrame(const ExportFrame& frame) // BT.601 full range, chroma averaged over 2x2 blocks
+	{
+		const unsigned int w = frame.width & ~1u;
+		const unsigned int h = frame.height & ~1u;
+
+		if (this->videoFile == nullptr)
+		{
+			const std::string path = this->outputPrefix + ".y4m";
+			this->videoFile = std::fopen(path.c_str(), "wb");
+			if (this->videoFile == nullptr)
+			{
+				std::cout << "Error writing " << path << "\n";
+				return;
+			}
+			std::fprintf(this->videoFile, "YUV4MPEG2 W%u H%u F60:1 Ip A1:1 C420jpeg\n", w, h);
+		}
+
+		const size_t lumaSize = static_cast<size_t>(w) * h;
+		this->yuvPlanes.resize(lumaSize + lumaSize / 2);
+		sf::Uint8* yPlane = this->yuvPlanes.data();
+		sf::Uint8* uPlane = yPlane + lumaSize;
+		sf::Uint8* vPlane = uPlane + lumaSize / 4;
+
+		for (unsigned int y = 0; y < h; y++)
+		{
+			const sf::Uint8* row = frame.row(y);
+			for (unsigned int x = 0; x < w; x++)
+			{
+				const float r = row[x * 4], g = row[x * 4 + 1], b = row[x * 4 + 2];
+				yPlane[static_cast<size_t>(y) * w + x] = static_cast<sf::Uint8>(0.299f * r + 0.587f * g + 0.114f * b + 0.5f);
+			}
+		}
+
+		for (unsigned int y = 0; y < h; y += 2)
+		{
+			for (unsigned int x = 0; x < w; x += 2)
+			{
+				float r = 0.f, g = 0.f, b = 0.f;
+				for (unsigned int i = 0; i < 4; i++)
+				{
+					const sf::Uint8* p = frame.row(y + i / 2) + (x + i % 2) * 4;
+					r += p[0];
+					g += p[1];
+					b += p[2];
+				}
+				r *= 0.25f;
+				g *= 0.25f;
+				b *= 0.25f;
+
+				const size_t c = static_cast<size_t>(y / 2) * (w / 2) + x / 2;
+				uPlane[c] = static_cast<sf::Uint8>(std::max(0.f, std::min(255.f, -0.168736f * r - 0.331264f * g + 0.5f * b + 128.5f)));
+				vPlane[c] = static_cast<sf::Uint8>(std::max(0.f, std::min(255.f, 0.5f * r - 0.418688f * g - 0.081312f * b + 128.5f)));
+			}
+		}
+
+		std::fputs("FRAME\n", this->videoFile);
+		std::fwrite(this->yuvPlanes.data(), 1, this->yuvPlanes.size(), this->videoFile);
+	}
+
+public:
+	FrameExporter()
+	{
+
+	}
+
+	~FrameExporter()
+	{
+		this->stop();
+	}
+
+	FrameExporter(const FrameExporter&) = delete;
+	FrameExporter& operator=(const FrameExporter&) = delete;
+
+	bool isRunning() const
+	{
+		return !this->encoders.empty();
+	}
+
+	void start(const std::string& prefix, ExportFormat exportFormat, ExportPolicy exportPolicy, size_t capacity = 8, size_t encoderCount = 2)
+	{
+		this->stop();
+
+		this->outputPrefix = prefix;
+		this->format = exportFormat;
+		this->policy = exportPolicy;
+		this->queueCapacity = std::max<size_t>(1, capacity);
+		this->nextFrameNumber = 0;
+		this->framesWritten.store(0);
+		this->framesDropped.store(0);
+		this->stopping = false;
+
+		this->framePool.assign(this->queueCapacity, ExportFrame());
+		this->freeFrames.clear();
+		for (ExportFrame& frame : this->framePool)
+		{
+			this->freeFrames.push_back(&frame);
+		}
+
+		// a video has to be written in order, so it gets one encoder
+		const size_t threads = exportFormat == ExportFormat::Y4M ? 1 : std::max<size_t>(1, encoderCount);
+		for (size_t i = 0; i < threads; i++)
+		{
+			this->encoders.emplace_back(&FrameExporter::encoderLoop, this);
+		}
+	}
+
+	void stop() // writes out everything still queued, then joins the encoders
+	{
+		if (this->encoders.empty())
+			return;
+
+		{
+			std::lock_guard<std::mutex> guard(this->queueLock);
+			this->stopping = true;
+		}
+		this->frameQueued.notify_all();
+
+		for (std::thread& encoder : this->encoders)
+		{
+			encoder.join();
+		}
+		this->encoders.clear();
+
+		if (this->videoFile)
+		{
+			std::fclose(this->videoFile);
+			this->videoFile = nullptr;
+		}
+	}
+
+	bool submit(const sf::Uint8* rgba, unsigned int width, unsigned int height) // copies the frame, returns false if it was dropped
+	{
+		return this->submitWith(width, height, false, [rgba, width, height](sf::Uint8* slot) {
+			std::memcpy(slot, rgba, static_cast<size_t>(width) * height * 4);
+		});
+	}
+
+	// fill(slot) writes the width * height * 4 bytes of the frame straight into a pooled buffer, bottomUp if it writes the
+	// rows last first. fill isn't called for a dropped frame, returns false then.
+	template <class Fill>
+	bool submitWith(unsigned int width, unsigned int height, bool bottomUp, Fill&& fill)
+	{
+		if (this->encoders.empty())
+			return false;
+
+		ExportFrame* frame = nullptr;
+		{
+			std::unique_lock<std::mutex> guard(this->queueLock);
+			if (this->freeFrames.empty())
+			{
+				if (this->policy == ExportPolicy::DropNewest)
+				{
+					this->framesDropped.fetch_add(1);
+					return false;
+				}
+				this->slotFreed.wait(guard, [this] { return !this->freeFrames.empty(); });
+			}
+
+			frame = this->freeFrames.back();
+			this->freeFrames.pop_back();
+		}
+
+		// the fill happens outside the lock, the frame is ours until it is queued
+		frame->width = width;
+		frame->height = height;
+		frame->bottomUp = bottomUp;
+		frame->frameNumber = ++this->nextFrameNumber;
+		frame->rgba.resize(static_cast<size_t>(width) * height * 4);
+		fill(frame->rgba.data());
+
+		{
+			std::lock_guard<std::mutex> guard(this->queueLock);
+			this->queuedFrames.push_back(frame);
+		}
+		this->frameQueued.notify_one();
+		return true;
+	}
+
+	size_t getFramesWritten() const
+	{
+		return this->framesWritten.load();
+	}
+
+	size_t getFramesDropped() const
+	{
+		return this->framesDropped.load();
+	}
+};
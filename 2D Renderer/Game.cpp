@@ -15,21 +15,120 @@ void Game::initVariables()
 	this->start = steady_clock::now();
 	this->displayFpsTitle = false;
 	this->fpsUpdateInterval = std::chrono::milliseconds(100);
+	this->physicsSeconds = 0.f;
+	for (size_t p = 0; p < static_cast<size_t>(AllocPhase::Count); p++)
+	{
+		this->lastAllocCounts[p] = 0;
+		this->shownAllocCounts[p] = 0;
+	}
 
 	// Game logic
 	this->physicsUpdateInterval = std::chrono::milliseconds(40);
 	this->nextPhysicsUpdate = std::chrono::steady_clock().now() + this->physicsUpdateInterval;
-	this->fps = "N/A";
+	std::snprintf(this->fps, sizeof(this->fps), "N/A");
+	this->physicsSystem.threadPool = &this->physicsThreads;
+	this->fluid.threadPool = &this->physicsThreads;
+	this->captureInterval = std::chrono::microseconds(1000000 / 60);
+	this->showcaseActive = false;
+	this->showcaseFrame = 0;
+	this->mixedMaterials = false;
+	this->fluidMode = false;
+	this->fluidLoaded = false;
+	this->brushRadius = 30.f;
+	this->hoverBallCount = 0;
 
 	// clear balls function
 	auto clearBalls = [this](SquareButton* button) {
+		this->stopShowcase();
 		this->physicsSystem.clearVerletObjects();
+		this->fluidLoaded = false;
 	};
 
     this->butManager.AddButton("Clear Balls", sf::Vector2f(5.f, 130.f), sf::Vector2f(100.f, 20.f), clearBalls, this->font);
 
+	// toggle thin shelves inside the collider
+	auto toggleShelves = [this](SquareButton* button) {
+		this->stopShowcase();
+		if (!this->physicsSystem.staticSegments.empty())
+		{
+			this->physicsSystem.clearStaticSegments();
+			return;
+		}
+
+		this->fluidMode = false; // the fluid solver has no segment constraint
+		const sf::Vector2f c = this->physicsSystem.collider_pos;
+		this->physicsSystem.addStaticSegment(c + sf::Vector2f(-200.f, -60.f), c + sf::Vector2f(-20.f, 0.f), 2.f);
+		this->physicsSystem.addStaticSegment(c + sf::Vector2f(200.f, 40.f), c + sf::Vector2f(20.f, 100.f), 2.f);
+	};
+
+	this->butManager.AddButton("Shelves", sf::Vector2f(5.f, 160.f), sf::Vector2f(100.f, 20.f), toggleShelves, this->font);
+
+	// cycle what the ball colours show
+	auto cycleColors = [this](SquareButton* button) {
+		const int next = (static_cast<int>(this->physicsSystem.ballColorMode) + 1) % static_cast<int>(BallColorMode::Count);
+		this->physicsSystem.ballColorMode = static_cast<BallColorMode>(next);
+	};
+
+	this->butManager.AddButton("Colors", sf::Vector2f(5.f, 190.f), sf::Vector2f(100.f, 20.f), cycleColors, this->font);
+
+	// colour the balls by an image, then replay the same scene so the pile forms it
+	auto showcase = [this](SquareButton* button) {
+		this->startShowcase();
+	};
+
+	this->butManager.AddButton("Showcase", sf::Vector2f(5.f, 220.f), sf::Vector2f(100.f, 20.f), showcase, this->font);
+
+	// spawn a mix of heavy and light balls
+	auto toggleMixed = [this](SquareButton* button) {
+		this->mixedMaterials = !this->mixedMaterials;
+	};
+
+	this->butManager.AddButton("Mixed Mass", sf::Vector2f(5.f, 250.f), sf::Vector2f(100.f, 20.f), toggleMixed, this->font);
+
+	// toggle a fountain that sprays balls up from the left, with a drain at the bottom so it runs forever
+	auto toggleFountain = [this](SquareButton* button) {
+		this->stopShowcase(); // the replay has to see exactly the scripted balls
+		if (this->ballFlow.isActive())
+		{
+			this->ballFlow.clear();
+			return;
+		}
+
+		this->ballFlow.addFountain(this->physicsSystem.collider_pos);
+	};
+
+	this->butManager.AddButton("Fountain", sf::Vector2f(5.f, 280.f), sf::Vector2f(100.f, 20.f), toggleFountain, this->font);
+
+	// swap the collider circle for a box whose edges wrap around
+	auto togglePeriodic = [this](SquareButton* button) {
+		this->stopShowcase();
+		const bool periodic = this->physicsSystem.boundaryMode == BoundaryMode::Periodic;
+		this->physicsSystem.setBoundaryMode(periodic ? BoundaryMode::Collider : BoundaryMode::Periodic);
+		if (!periodic)
+			this->fluidMode = false; // the fluid only knows the collider circle
+	};
+
+	this->butManager.AddButton("Periodic", sf::Vector2f(5.f, 310.f), sf::Vector2f(100.f, 20.f), togglePeriodic, this->font);
+
+	// simulate the balls as a liquid, packed twice as densely as the balls sit. The fluid solver only has the collider
+	// circle, so turning it on drops the periodic box and the shelves, and turning either of those on leaves fluid mode
+	auto toggleFluid = [this](SquareButton* button) {
+		this->stopShowcase();
+		this->fluidMode = !this->fluidMode;
+		if (this->fluidMode)
+		{
+			this->physicsSystem.setBoundaryMode(BoundaryMode::Collider);
+			this->physicsSystem.clearStaticSegments();
+		}
+	};
+
+	this->butManager.AddButton("Fluid", sf::Vector2f(5.f, 340.f), sf::Vector2f(100.f, 20.f), toggleFluid, this->font);
+
+	// gravity is part of the replayed settings, so the buttons do nothing while the showcase runs
 	// grav set left
 	auto gravLeft = [this](SquareButton* button) {
+		if (this->showcaseActive)
+			return;
 		this->physicsSystem.gravity.x -= 100.f;
 	};
 
@@ -37,6 +136,8 @@ void Game::initVariables()
 
 	// grav set right
 	auto gravRight = [this](SquareButton* button) {
+		if (this->showcaseActive)
+			return;
 		this->physicsSystem.gravity.x += 100.f;
 		};
 
@@ -44,6 +145,8 @@ void Game::initVariables()
 
 	// grav set upwards
 	auto gravUp = [this](SquareButton* button) {
+		if (this->showcaseActive)
+			return;
 		this->physicsSystem.gravity.y -= 100.f;
 		};
 
@@ -51,12 +154,16 @@ void Game::initVariables()
 
 	// grav set downwards
 	auto gravDown = [this](SquareButton* button) {
+		if (this->showcaseActive)
+			return;
 		this->physicsSystem.gravity.y += 100.f;
 		};
 
 	this->butManager.AddButton(" D", sf::Vector2f(50.f, 530.f), sf::Vector2f(20.f, 20.f), gravDown, this->font);
 
 	auto gravReset = [this](SquareButton* button) {
+		if (this->showcaseActive)
+			return;
 		this->physicsSystem.gravity.x = 0.f;
 		this->physicsSystem.gravity.y = 1000.f;
 		};
@@ -75,10 +182,29 @@ void Game::initResources()
 }
 void Game::initText()
 {
-	this->uiText.setFont(this->font);
-	this->uiText.setCharacterSize(18);
-	this->uiText.setFillColor(sf::Color::White);
-	this->uiText.setString("N/A");
+	sf::Text& uiText = this->hud.getText();
+	uiText.setFont(this->font);
+	uiText.setCharacterSize(18);
+	uiText.setFillColor(sf::Color::White);
+
+	sf::Text& statsText = this->statsHud.getText();
+	statsText.setFont(this->font);
+	statsText.setCharacterSize(14);
+	statsText.setFillColor(sf::Color::White);
+	statsText.setPosition(this->window->getDefaultView().getSize().x - 200.f, 0.f);
+
+	// the ui is laid out in the default view, the cached layer covers exactly that
+	const sf::Vector2f uiSize = this->window->getDefaultView().getSize();
+	if (!this->uiLayer.create(static_cast<unsigned int>(uiSize.x), static_cast<unsigned int>(uiSize.y)))
+		std::cout << "Error creating ui layer!" << "\n";
+	this->uiLayerSprite.setTexture(this->uiLayer.getTexture(), true);
+}
+
+void Game::redrawUiLayer()
+{
+	this->uiLayer.clear(sf::Color::Transparent);
+	this->butManager.render(this->uiLayer);
+	this->uiLayer.display();
 }
 void Game::initWindow()
 {
@@ -86,6 +212,22 @@ void Game::initWindow()
 	this->videoMode.height = 480;
 	this->window = new RenderWindow(VideoMode(800, 600), "Ball Simulator", Style::Titlebar | Style::Close | Style::Resize);
 	this->window->setIcon(this->windowIcon.getSize().x, this->windowIcon.getSize().y, this->windowIcon.getPixelsPtr());
+
+	this->isPanning = false;
+	this->resetCamera();
+}
+
+void Game::resetCamera()
+{
+	this->cameraView = this->window->getDefaultView();
+}
+
+void Game::zoomCamera(float delta, sf::Vector2i mousePixel) // zooms around the mouse so the point under it stays put
+{
+	const sf::Vector2f before = this->window->mapPixelToCoords(mousePixel, this->cameraView);
+	this->cameraView.zoom(delta > 0.f ? 0.9f : 1.f / 0.9f);
+	const sf::Vector2f after = this->window->mapPixelToCoords(mousePixel, this->cameraView);
+	this->cameraView.move(before - after);
 }
 
 void Game::PollEvents()
@@ -98,14 +240,162 @@ void Game::PollEvents()
 			this->window->close();
 			break;
 
+		case Event::Resized: // the capture target and a video's frame size are fixed when capture starts
+			if (this->frameExporter.isRunning())
+			{
+				std::cout << "Window resized, ";
+				this->toggleCapture(ExportFormat::PngSequence); // stops it
+			}
+			break;
+
 		case Event::KeyPressed:
 			if (this->ev.key.code == Keyboard::Escape)
 			{
 				this->window->close();
 				break;
 			}
+			if (this->ev.key.code == Keyboard::Home) // back to the whole scene
+				this->resetCamera();
+			if (this->ev.key.code == Keyboard::F9)
+				this->toggleCapture(ExportFormat::PngSequence);
+			if (this->ev.key.code == Keyboard::F10)
+				this->toggleCapture(ExportFormat::Y4M);
+			if (this->ev.key.code == Keyboard::F8) // start the percentiles over, e.g. after changing the scene
+			{
+				this->frameStats.reset();
+				this->framePacer.resetStats();
+			}
+			break;
+
+		// camera, wheel zooms and middle mouse drags
+		case Event::MouseWheelScrolled:
+			this->zoomCamera(this->ev.mouseWheelScroll.delta, sf::Vector2i(this->ev.mouseWheelScroll.x, this->ev.mouseWheelScroll.y));
+			break;
+
+		case Event::MouseButtonPressed:
+			if (this->ev.mouseButton.button == Mouse::Middle)
+			{
+				this->isPanning = true;
+				this->panLastMouse = sf::Vector2i(this->ev.mouseButton.x, this->ev.mouseButton.y);
+			}
+			break;
+
+		case Event::MouseButtonReleased:
+			if (this->ev.mouseButton.button == Mouse::Middle)
+				this->isPanning = false;
+			break;
+
+		case Event::MouseMoved:
+			if (this->isPanning)
+			{
+				const sf::Vector2i mouse(this->ev.mouseMove.x, this->ev.mouseMove.y);
+				this->cameraView.move(this->window->mapPixelToCoords(this->panLastMouse, this->cameraView) - this->window->mapPixelToCoords(mouse, this->cameraView));
+				this->panLastMouse = mouse;
+			}
+			break;
+		}
+	}
+}
+
+void Game::toggleCapture(ExportFormat format)
+{
+	if (this->frameExporter.isRunning())
+	{
+		this->frameExporter.stop();
+		std::cout << "Capture stopped, " << this->frameExporter.getFramesWritten() << " frames written, " << this->frameExporter.getFramesDropped() << " dropped\n";
+		return;
+	}
+
+	const sf::Vector2u size = this->window->getSize();
+	if (!this->exportTarget.create(size.x, size.y))
+	{
+		std::cout << "Error creating capture target!" << "\n";
+		return;
+	}
+
+	// dropping keeps the loop running at full speed if the encoders fall behind
+	this->frameExporter.start("capture", format, ExportPolicy::DropNewest);
+	this->nextCaptureTime = steady_clock::now();
+}
+
+void Game::startShowcase()
+{
+	// headless pass with the current settings, samples the window icon at the final ball positions
+	const double seconds = this->showcase.computeColors(this->windowIcon, this->physicsSystem, &this->physicsThreads);
+	std::cout << "Showcase: " << this->showcase.script.getTargetFrame() << " frames simulated in " << seconds << " s\n";
+
+	this->physicsSystem.clearVerletObjects();
+	this->physicsSystem.ballColorMode = BallColorMode::Stored;
+	this->ballFlow.clear(); // the replay has to see exactly the scripted balls
+	this->showcaseActive = true;
+	this->showcaseFrame = 0;
+}
+
+void Game::stopShowcase()
+{
+	if (!this->showcaseActive)
+		return;
+
+	this->showcaseActive = false;
+	std::cout << "Showcase replay stopped at frame " << this->showcaseFrame << "\n";
+}
+
+void Game::applyMouseTools(sf::Vector2f mousePos) // mousePos in solver coordinates
+{
+	this->physicsSystem.refreshSpatialIndex();
+
+	if (Keyboard::isKeyPressed(Keyboard::Delete))
+	{
+		this->queryResults.clear();
+		if (QueryBallsInCircle(this->physicsSystem, mousePos, this->brushRadius, this->queryResults) > 0)
+		{
+			// removal asks about the balls in index order, so walk the sorted hits alongside it
+			std::sort(this->queryResults.begin(), this->queryResults.end());
+			size_t next = 0;
+			this->physicsSystem.removeVerletObjectsIf([this, &next](size_t i) {
+				if (next < this->queryResults.size() && this->queryResults[next] == i)
+				{
+					next++;
+					return true;
+				}
+				return false;
+			});
+			this->physicsSystem.refreshSpatialIndex();
+			this->fluidLoaded = false;
+		}
+	}
+
+	if (Keyboard::isKeyPressed(Keyboard::LShift) && sf::Mouse::isButtonPressed(sf::Mouse::Button::Left))
+	{
+		// the ball keeps its last position, so it is thrown with the mouse's speed when let go
+		if (QueryNearestBalls(this->physicsSystem, mousePos, 1, this->queryResults) == 1
+			&& EuclideanDist(SpatialQueries::ballCenter(this->physicsSystem, this->queryResults[0]), mousePos) <= this->brushRadius)
+		{
+			const float r = this->physicsSystem.obj_radius;
+			this->physicsSystem.verletObjList[this->queryResults[0]].curPos = mousePos - sf::Vector2f(r, r);
+			this->fluidLoaded = false;
 		}
 	}
+
+	// held keys put a force field under the cursor: A attracts, S repels, V swirls (not in fluid mode, the fluid solver has no fields)
+	this->physicsSystem.forceFields.clear();
+	const Keyboard::Key fieldKeys[3] = { Keyboard::A, Keyboard::S, Keyboard::V };
+	const ForceFieldType fieldTypes[3] = { ForceFieldType::Attractor, ForceFieldType::Repeller, ForceFieldType::Vortex };
+	for (int i = 0; i < 3 && !this->fluidMode; i++)
+	{
+		if (!Keyboard::isKeyPressed(fieldKeys[i]))
+			continue;
+
+		ForceField field;
+		field.type = fieldTypes[i];
+		field.position = mousePos;
+		field.radius = this->brushRadius * 4.f;
+		field.strength = 6000.f;
+		this->physicsSystem.forceFields.push_back(field);
+	}
+
+	this->queryResults.clear();
+	this->hoverBallCount = QueryBallsInCircle(this->physicsSystem, mousePos, this->brushRadius, this->queryResults);
 }
 
 void Game::calcFps() // ran right after rendering
@@ -113,10 +403,23 @@ void Game::calcFps() // ran right after rendering
 
 	// FPS window title displaying
 	this->end = steady_clock::now();
+
+	// Calculate frame duration in seconds
+	float frameDurationSec = std::chrono::duration<float>(this->end - this->start).count();
+	this->frameStats.endFrame(frameDurationSec, this->physicsSystem.stats.subSteps, this->physicsSystem.verletObjList.size(), this->physicsSystem.stats.counters.contactsResolved);
+
 	if (this->nextUpdate <= this->end) // Update only at intervals
 	{
-		// Calculate frame duration in seconds
-		float frameDurationSec = std::chrono::duration<float>(this->end - this->start).count();
+		this->shownFrameTimes = this->frameStats.summarize(FramePhase::Total);
+		this->shownSolverCounters = this->physicsSystem.stats.counters;
+		this->shownPacing = this->framePacer.summarize();
+
+		for (size_t p = 0; p < static_cast<size_t>(AllocPhase::Count); p++)
+		{
+			const uint64_t allocations = AllocTracker::getCounts(static_cast<AllocPhase>(p)).allocations;
+			this->shownAllocCounts[p] = allocations - this->lastAllocCounts[p];
+			this->lastAllocCounts[p] = allocations;
+		}
 
 		// Avoid division by zero
 		if (frameDurationSec > 0.0f) // really should never reach 0 since thats just perfect frame duration so itll skip that frame of calc
@@ -134,15 +437,13 @@ void Game::calcFps() // ran right after rendering
 			this->smoothedFPS = alpha * currentFPS + (1.0f - alpha) * this->smoothedFPS;
 
 			// Format smoothed FPS
-			std::stringstream stream;
-			stream << std::fixed << std::setprecision(2) << this->smoothedFPS; // Precision to 2 decimal places
-			std::string fpsString = stream.str();
-
-			this->fps = fpsString;
+			std::snprintf(this->fps, sizeof(this->fps), "%.2f", this->smoothedFPS); // Precision to 2 decimal places
 
 			if (this->displayFpsTitle)
 			{
-				this->window->setTitle("FPS: " + fpsString);
+				char title[32];
+				std::snprintf(title, sizeof(title), "FPS: %s", this->fps);
+				this->window->setTitle(title);
 			}
 		}
 
@@ -167,6 +468,9 @@ Game::Game()
 
 Game::~Game()
 {
+	if (!this->frameStats.writeReport("frame_stats.csv"))
+		std::cout << "Error writing frame_stats.csv" << "\n";
+
 	delete this->window;
 }
 
@@ -182,6 +486,9 @@ void Game::setDisplayTitleFps(bool boolPar) { // lets you set if the fps is disp
 void Game::setFpsUpdateInterval(std::chrono::milliseconds msPar) { // lets you set how often the fps changes in the title in milliseconds
 	this->fpsUpdateInterval = msPar;
 }
+void Game::setTargetFramerate(float framesPerSecond) { // frames per second the loop is paced to, 0 for no limit
+	this->framePacer.setTargetRate(framesPerSecond);
+}
 
 /*
 * Public functions
@@ -189,49 +496,154 @@ void Game::setFpsUpdateInterval(std::chrono::milliseconds msPar) { // lets you s
 
 void Game::update() // game logic and functionality
 {
+	const auto updateStart = steady_clock::now();
+	this->physicsSeconds = 0.f;
+
+	AllocTracker::setPhase(AllocPhase::UI);
 	this->PollEvents();
     this->butManager.update(*this->window);
 
 	if (this->nextPhysicsUpdate <= std::chrono::steady_clock().now())
 	{
-		// all this code determines if mouse clicks and to add a ball to the enviroment if it does
-		sf::Vector2f mousePos = this->window->mapPixelToCoords(sf::Mouse::getPosition(*this->window));
-		float eqX = mousePos.x - this->physicsSystem.backgroundCircle.getPosition().x;
-		float eqY = mousePos.y - this->physicsSystem.backgroundCircle.getPosition().y;
-		float dist = (eqX * eqX) + (eqY * eqY);
-		float maxDist = this->physicsSystem.collider_radius * this->physicsSystem.collider_radius;
-
-		if (dist <= maxDist)
+		const auto physicsStart = steady_clock::now();
+		AllocScope physicsScope(AllocPhase::Physics);
+
+		if (this->showcaseActive) // replaying, mouse input would break the determinism the colours rely on
 		{
-			if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Left))
+			this->showcase.replayFrame(this->physicsSystem, this->showcaseFrame++);
+			this->fluidLoaded = false;
+			if (this->showcaseFrame == this->showcase.script.getTargetFrame())
 			{
-				this->physicsSystem.addVerletObject(mousePos);
+				this->showcaseActive = false;
+				std::cout << "Showcase replay " << (this->showcase.verifyReplay(this->physicsSystem) ? "matched" : "DIVERGED from") << " the headless pass\n";
 			}
+		}
+		else
+		{
+			// all this code determines if mouse clicks and to add a ball to the enviroment if it does
+			const sf::Vector2f mouseWorld = this->window->mapPixelToCoords(sf::Mouse::getPosition(*this->window), this->cameraView);
+			sf::Vector2f mousePos = this->physicsSystem.worldToLocal(sf::Vector2<double>(mouseWorld.x, mouseWorld.y));
+			float eqX = mousePos.x - this->physicsSystem.backgroundCircle.getPosition().x;
+			float eqY = mousePos.y - this->physicsSystem.backgroundCircle.getPosition().y;
+			float dist = (eqX * eqX) + (eqY * eqY);
+			float maxDist = this->physicsSystem.collider_radius * this->physicsSystem.collider_radius;
+			const bool inPeriodicBox = this->physicsSystem.boundaryMode == BoundaryMode::Periodic && sf::FloatRect(this->physicsSystem.periodicOrigin, this->physicsSystem.periodicSize).contains(mousePos);
+
+			this->applyMouseTools(mousePos);
+
+			const size_t firstSpawned = this->physicsSystem.verletObjList.size();
+			if (dist <= maxDist || inPeriodicBox)
+			{
+				if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Left) && !Keyboard::isKeyPressed(Keyboard::LShift))
+				{
+					this->physicsSystem.addVerletObject(mousePos);
+				}
 
-			if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Right))
+				if (sf::Mouse::isButtonPressed(sf::Mouse::Button::Right))
+				{
+					for (size_t i = 0; i < 100; i++)
+					{
+						this->physicsSystem.addVerletObject(mousePos + sf::Vector2f(static_cast<float>(i*2), 0.f));
+					}
+				}
+			}
+
+			if (this->mixedMaterials)
 			{
-				for (size_t i = 0; i < 100; i++)
+				BallMaterial heavy;
+				heavy.mass = 4.f;
+				heavy.restitution = 0.3f;
+				heavy.friction = 0.1f;
+				for (size_t i = firstSpawned + firstSpawned % 2; i < this->physicsSystem.verletObjList.size(); i += 2) // even indices
 				{
-					this->physicsSystem.addVerletObject(mousePos + sf::Vector2f(static_cast<float>(i*2), 0.f));
+					this->physicsSystem.setBallMaterial(i, heavy);
+					this->physicsSystem.verletObjList[i].color = sf::Color(150, 60, 60, 255);
 				}
 			}
-		}
 
+			float dt = 1.f/30.f;
+
+			if (this->ballFlow.isActive())
+			{
+				const uint64_t removedBefore = this->ballFlow.stats.removedBySinks + this->ballFlow.stats.expired;
+				this->ballFlow.update(this->physicsSystem, dt);
+				if (this->ballFlow.stats.removedBySinks + this->ballFlow.stats.expired != removedBefore)
+					this->fluidLoaded = false;
+			}
 
-		float dt = 1.f/30.f;
+			if (this->fluidMode)
+			{
+				// the particles stay in the fluid solver in their cell order, reloading them from the balls would put them back
+				// in ball order and cost a random gather every tick. Balls spawned since the last tick are appended.
+				if (!this->fluidLoaded || this->physicsSystem.verletObjList.size() < this->fluid.size())
+					this->fluid.loadFrom(this->physicsSystem);
+				else
+					this->fluid.addBallsFrom(this->physicsSystem);
+				this->fluidLoaded = true;
+				this->fluid.gravity = this->physicsSystem.gravity;
+				this->fluid.update(dt);
+				this->fluid.storeTo(this->physicsSystem);
+			}
+			else
+			{
+				this->physicsSystem.update(dt);
+				this->fluidLoaded = false;
+			}
+		}
 
-		this->physicsSystem.update(dt);
+		this->physicsSeconds = std::chrono::duration<float>(steady_clock::now() - physicsStart).count();
+		this->frameStats.recordPhase(FramePhase::Physics, this->physicsSeconds);
 
 		this->nextPhysicsUpdate = std::chrono::steady_clock().now() + this->physicsUpdateInterval;
 	};
 
-	std::stringstream ss;
+	this->hud.begin();
+	this->hud.appendf(" Balls: %zu\n FPS: %s\n Under cursor: %zu\n", this->physicsSystem.verletObjList.size(), this->fps, this->hoverBallCount);
+
+	if (this->frameExporter.isRunning())
+		this->hud.appendf(" REC: %zu (%zu dropped)\n", this->frameExporter.getFramesWritten(), this->frameExporter.getFramesDropped());
+
+	this->hud.appendf(" Grav:\n (%g, %g)\n", this->physicsSystem.gravity.x, this->physicsSystem.gravity.y);
 
-	ss << " Balls: " << this->physicsSystem.verletObjList.size() << "\n"
-		<< " FPS: " << this->fps << "\n"
-		<< " Grav:\n (" << this->physicsSystem.gravity.x << ", " << this->physicsSystem.gravity.y << ")\n";
+	if (this->ballFlow.isActive())
+		this->hud.appendf(" Flow: +%llu -%llu\n", static_cast<unsigned long long>(this->ballFlow.stats.emitted),
+			static_cast<unsigned long long>(this->ballFlow.stats.removedBySinks + this->ballFlow.stats.expired));
+	this->hud.commit();
 
-	this->uiText.setString(ss.str());
+	this->statsHud.begin();
+	this->statsHud.appendf("Substeps: %d\nKernel: %s\nDraw: %s\nColors: %s\nFrame ms p50/95/99/max:\n%.1f/%.1f/%.1f/%.1f\n",
+		this->fluidMode ? this->fluid.subSteps : this->physicsSystem.stats.subSteps,
+		this->fluidMode ? "fluid" : this->physicsSystem.stats.kernelName,
+		this->physicsSystem.densityRenderActive ? "density" : "balls",
+		ballColorModeName(this->physicsSystem.ballColorMode),
+		this->shownFrameTimes.p50, this->shownFrameTimes.p95, this->shownFrameTimes.p99, this->shownFrameTimes.max);
+
+	if (this->framePacer.getTargetRate() > 0.f)
+	{
+		this->statsHud.appendf("Paced %.0f Hz, idle %.0f%%\nWake late p99: %.2f ms\n",
+			this->framePacer.getTargetRate(), this->shownPacing.idleFraction * 100.f, this->shownPacing.wakeError.p99);
+	}
+
+	if (solverCountersEnabled)
+	{
+		this->statsHud.appendf("Pairs/contacts:\n%llu/%llu\nWall hits: %llu\nField tests: %llu\nMax overlap: %.2f px\n",
+			static_cast<unsigned long long>(this->shownSolverCounters.pairsTested),
+			static_cast<unsigned long long>(this->shownSolverCounters.contactsResolved),
+			static_cast<unsigned long long>(this->shownSolverCounters.boundaryHits + this->shownSolverCounters.segmentHits),
+			static_cast<unsigned long long>(this->shownSolverCounters.fieldTests),
+			this->shownSolverCounters.maxOverlap);
+	}
+
+	if (AllocTracker::isEnabled())
+	{
+		this->statsHud.appendf("Allocs phys/render/ui:\n%llu/%llu/%llu\n",
+			static_cast<unsigned long long>(this->shownAllocCounts[static_cast<size_t>(AllocPhase::Physics)]),
+			static_cast<unsigned long long>(this->shownAllocCounts[static_cast<size_t>(AllocPhase::Render)]),
+			static_cast<unsigned long long>(this->shownAllocCounts[static_cast<size_t>(AllocPhase::UI)]));
+	}
+	this->statsHud.commit();
+
+	this->frameStats.recordPhase(FramePhase::Update, std::chrono::duration<float>(steady_clock::now() - updateStart).count() - this->physicsSeconds);
 }
 
 void Game::render() // rendering pixels on screen
@@ -241,15 +653,53 @@ void Game::render() // rendering pixels on screen
 	* - clear window with color
 	* - draw objects
 	* - display window
+	* While capturing the same is drawn into the export target, which is then copied to the window.
 	*/
 
-	this->window->clear();
+	const auto renderStart = steady_clock::now();
+	AllocTracker::setPhase(AllocPhase::Render);
+	const bool capturing = this->frameExporter.isRunning();
+	sf::RenderTarget& target = capturing ? static_cast<sf::RenderTarget&>(this->exportTarget) : *this->window;
+
+	target.clear();
+
+	// render here, world through the camera then ui on top
+	target.setView(this->cameraView);
+	this->physicsSystem.render(&target);
+	target.setView(target.getDefaultView());
+	if (this->butManager.consumeRedraw())
+		this->redrawUiLayer();
+	target.draw(this->uiLayerSprite);
+	target.draw(this->hud.getText());
+	target.draw(this->statsHud.getText());
+
+	if (capturing)
+	{
+		this->exportTarget.display();
+		this->window->clear();
+		this->window->setView(this->exportTarget.getDefaultView()); // the target is the window's size, drawn 1:1
+		this->window->draw(sf::Sprite(this->exportTarget.getTexture()));
 
-	// render here
-	this->physicsSystem.render(this->window);
-    this->butManager.render(*this->window);
-	this->window->draw(this->uiText);
+		if (this->nextCaptureTime <= steady_clock::now()) // capture at the export rate, not every loop
+		{
+			// read the target's pixels straight into the exporter's pooled slot, the one copy the frame gets. OpenGL hands
+			// the rows back bottom first, the encoders flip them. A dropped frame isn't read back at all.
+			const auto captureStart = steady_clock::now();
+			const sf::Vector2u size = this->exportTarget.getSize();
+			this->frameExporter.submitWith(size.x, size.y, true, [this, size](sf::Uint8* slot) {
+				if (this->exportTarget.setActive(true))
+					glReadPixels(0, 0, static_cast<GLsizei>(size.x), static_cast<GLsizei>(size.y), GL_RGBA, GL_UNSIGNED_BYTE, slot);
+			});
+			this->frameStats.recordPhase(FramePhase::Capture, std::chrono::duration<float>(steady_clock::now() - captureStart).count());
+			this->nextCaptureTime += this->captureInterval;
+			if (this->nextCaptureTime < steady_clock::now()) // fell behind, don't burst to catch up
+				this->nextCaptureTime = steady_clock::now() + this->captureInterval;
+		}
+	}
 
 	this->window->display();
+	this->frameStats.recordPhase(FramePhase::Render, std::chrono::duration<float>(steady_clock::now() - renderStart).count());
+	AllocTracker::setPhase(AllocPhase::Other);
+	this->framePacer.wait(); // counts towards the frame total but not render
 	this->calcFps();
 }
\ No newline at end of file
@@ -2,18 +2,27 @@
 
 // STL includes
 #include <chrono>
-#include <iomanip>
-#include <sstream>
+#include <cstdio>
 #include <vector>
 #include <ctime>
 #include <iostream>
 
 // SFML includes
 #include <SFML/Graphics.hpp>
+#include <SFML/OpenGL.hpp>
 
 // Custom Includes
+#include "BallFlow.h"
+#include "FluidSolver.h"
 #include "PhysicsSolver.cpp"
+#include "SpatialQueries.h"
 #include "button_manager.h"
+#include "FrameExporter.h"
+#include "HudText.h"
+#include "util/alloc_tracker.h"
+#include "util/frame_pacer.h"
+#include "util/frame_stats.h"
+#include "ImageReplay.h"
 
 /*
 * Primary Game Engine Wrapper Class
@@ -35,10 +44,24 @@ class Game
 		std::chrono::steady_clock::time_point start, end, nextUpdate;
 		std::chrono::milliseconds fpsUpdateInterval;
 		bool displayFpsTitle;
-		std::string fps;
+		char fps[16]; // formatted in place so the hud doesn't allocate
 		void calcFps();
 		float smoothedFPS;
 
+		// frame time percentiles, F8 resets them and they are written to frame_stats.csv on exit
+		FrameStats frameStats;
+		PhaseSummary shownFrameTimes; // refreshed with the fps so the hud doesn't change every frame
+		SolverCounters shownSolverCounters; // same, from the last physics tick
+
+		// holds the loop to the target rate by sleeping, 0 runs flat out
+		FramePacer framePacer;
+		PacerSummary shownPacing;
+		float physicsSeconds; // time spent in the solver this frame
+
+		// heap allocations of every loop phase over the last fps interval, should read 0 once running steadily
+		uint64_t lastAllocCounts[static_cast<size_t>(AllocPhase::Count)];
+		uint64_t shownAllocCounts[static_cast<size_t>(AllocPhase::Count)];
+
 		/*
 		* Initializers
 		*/
@@ -54,6 +77,15 @@ class Game
 		// window updates
 		void PollEvents();
 
+		/*
+		* Camera
+		*/
+		sf::View cameraView; // world view, ui is drawn with the default view on top
+		bool isPanning;
+		sf::Vector2i panLastMouse;
+		void resetCamera();
+		void zoomCamera(float delta, sf::Vector2i mousePixel);
+
 		/*
 		* Resources
 		*/
@@ -63,14 +95,51 @@ class Game
 		/*
 		* Game Logic & Objects
 		*/
-		sf::Text uiText;
+		HudText hud; // only rebuilt when a shown value changes
+		HudText statsHud; // solver and frame time diagnostics, top right so it stays clear of the buttons
+
+		sf::RenderTexture uiLayer; // buttons drawn once, redrawn only when one changes
+		sf::Sprite uiLayerSprite;
+		void redrawUiLayer();
 
 		std::chrono::steady_clock::time_point nextPhysicsUpdate;
 		std::chrono::milliseconds physicsUpdateInterval;
 
+		ThreadPool physicsThreads; // shared by the solver's substep phases
 		PhysSolver physicsSystem;
 		button_manager butManager;
 
+		/*
+		* Frame capture, F9 toggles a PNG sequence and F10 a Y4M video
+		*/
+		FrameExporter frameExporter;
+		sf::RenderTexture exportTarget; // the frame is drawn here while capturing, then shown in the window
+		std::chrono::steady_clock::time_point nextCaptureTime;
+		std::chrono::microseconds captureInterval;
+		void toggleCapture(ExportFormat format);
+
+		/*
+		* Image mapped showcase, replays a scripted scene with colours from a headless run
+		*/
+		bool mixedMaterials; // every other spawned ball is heavy and bouncy, they sink through the light ones
+		BallFlow ballFlow; // emitters and sinks, the Fountain button fills it
+		bool fluidMode; // the balls are simulated as a position based fluid instead of colliding
+		FluidSolver fluid; // holds the particles while fluid mode runs, stored back into the balls every physics update for drawing and the mouse tools
+		bool fluidLoaded; // fluid matches the balls, false once anything but a fluid tick removed or moved one
+
+		// mouse tools on the spatial index: Delete erases under the cursor, shift + left drags the nearest ball,
+		// A / S / V hold an attractor / repeller / vortex force field on the cursor
+		std::vector<uint32_t> queryResults; // reused by every query so the tools don't allocate
+		float brushRadius;
+		size_t hoverBallCount; // balls within brushRadius of the cursor, for the hud
+		void applyMouseTools(sf::Vector2f mousePos);
+
+		ImageReplay showcase;
+		bool showcaseActive;
+		size_t showcaseFrame;
+		void startShowcase();
+		void stopShowcase(); // leaves the replay early, for anything that changes the scene it replays
+
 		//// MAIN FUNCTIONS ////
 
 		// contstructors & deconstructors
@@ -82,6 +151,7 @@ class Game
 
 		void setDisplayTitleFps(bool boolPar);
 		void setFpsUpdateInterval(std::chrono::milliseconds msPar);
+		void setTargetFramerate(float framesPerSecond);
 
 		// updates
 		void update();
@@ -0,0 +1,141 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cstdint>
+
+// custom includes
+#include "VerletGrid.cpp"
+#include "util/thread_pool.h"
+
+/*
+* Grid collision scheduling shared by the ball solvers (PhysSolver, PhysSolver3D, FixedPointSolver)
+* The solvers only bring their pair and boundary kernels, the loops around them are written once here over the grid and
+* vector type, so the 2D and 3D solvers run the same code:
+* - CollisionStripes splits the grid's columns into stripes and runs every other one in parallel
+* - CollideCell tests a cell against itself and the half of its neighbours that come after it
+* - AccelerateBodies and IntegrateBodies are the per ball passes around the collisions
+* A grid type provides Vec, Coord, halfNeighbourCount, halfNeighbour(i), contains, wrap, getCell(Coord) and
+* forEachCellInColumn, see VerletGrid and VerletGrid3D.
+*/
+
+template <class Func>
+inline void ForEachChunk(ThreadPool* pool, size_t count, size_t grain, Func&& func) // func(first, last) over [0, count), in parallel when there is a pool
+{
+	if (pool)
+		pool->parallelFor(0, count, grain, func);
+	else
+		func(0, count);
+}
+
+// every other stripe of stripeWidth grid columns. A cell only reaches into the next column, so a stripe writes to its own
+// columns plus one to the right and stripes of one colour never share a ball. They run in parallel and their order doesn't
+// matter, so results don't depend on the thread count.
+struct CollisionStripes
+{
+	int columnCount = 0;
+	int stripeWidth = 1;
+	int colour = 0; // 0 or 1
+
+	CollisionStripes(int columns, int width, int stripeColour) : columnCount(columns), stripeWidth(width), colour(stripeColour)
+	{
+
+	}
+
+	int stripeCount() const // both colours
+	{
+		return (columnCount + stripeWidth - 1) / stripeWidth;
+	}
+
+	size_t colourStripeCount() const
+	{
+		return static_cast<size_t>(std::max(0, (stripeCount() - colour + 1) / 2));
+	}
+
+	template <class Func>
+	void forEachColumn(size_t first, size_t last, Func&& func) const // func(x) for every column of this colour's stripes [first, last)
+	{
+		for (size_t s = first; s < last; s++)
+		{
+			const int columnStart = (static_cast<int>(s) * 2 + colour) * stripeWidth;
+			const int columnEnd = std::min(columnStart + stripeWidth, columnCount);
+			for (int x = columnStart; x < columnEnd; x++)
+			{
+				func(x);
+			}
+		}
+	}
+
+	template <class Func>
+	void run(ThreadPool* pool, bool serial, Func&& solveStripes) const // solveStripes(first, last) over this colour's stripes, serial when they can't be split
+	{
+		const size_t count = colourStripeCount();
+		if (count == 0)
+			return;
+
+		if (pool && !serial)
+			pool->parallelFor(0, count, 1, solveStripes);
+		else
+			solveStripes(0, count);
+	}
+};
+
+// collides a cell with itself and its half neighbours, contact(a, b, shift, wrapped) is called once per pair with b seen at its
+// position + shift. Without Periodic, neighbours outside the grid are skipped and wrapped is always false; with it they wrap
+// around to the opposite edge, period is the size of the wrapping box.
+template <bool Periodic, class Grid, class Contact>
+inline void CollideCell(const Grid& grid, typename Grid::Coord c, typename Grid::Vec period, Contact&& contact)
+{
+	const GridContent cell = grid.getCell(c);
+	if (cell.size() == 0)
+		return;
+
+	// self
+	const typename Grid::Vec noShift;
+	for (const uint32_t* a = cell.begin(); a != cell.end(); a++)
+	{
+		for (const uint32_t* b = a + 1; b != cell.end(); b++)
+		{
+			contact(*a, *b, noShift, false);
+		}
+	}
+
+	for (int i = 0; i < Grid::halfNeighbourCount; i++)
+	{
+		typename Grid::Coord n = c + Grid::halfNeighbour(i);
+		typename Grid::Vec shift;
+		if (Periodic)
+			n = grid.wrap(n, period, shift);
+		else if (!grid.contains(n))
+			continue;
+
+		const GridContent other = grid.getCell(n);
+		const bool wrapped = Periodic && shift != noShift;
+		for (uint32_t a : cell)
+		{
+			for (uint32_t b : other)
+			{
+				contact(a, b, shift, wrapped);
+			}
+		}
+	}
+}
+
+template <class Body, class Vec>
+inline void AccelerateBodies(Body* bodies, size_t first, size_t last, Vec acceleration) // adds acceleration to bodies [first, last), gravity
+{
+	for (size_t i = first; i < last; i++)
+	{
+		bodies[i].accelerate(acceleration);
+	}
+}
+
+template <class Body, class Constrain>
+inline void IntegrateBodies(Body* bodies, size_t first, size_t last, float dt, Constrain&& constrain) // verlet step then constrain(body), the solver's boundary, for bodies [first, last)
+{
+	for (size_t i = first; i < last; i++)
+	{
+		bodies[i].updatePosition(dt);
+		constrain(bodies[i]);
+	}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+// SFML includes
+#include <SFML/Graphics.hpp>
+
+/*
+* Allocation free HUD text
+* - lines are formatted printf style into a fixed buffer every frame
+* - the sf::Text is only touched when the buffer differs from what it is showing, so its geometry is rebuilt on change only
+* - the sf::String handed to it is persistent and refilled a character at a time, once it has grown
+*   to the longest text shown neither it nor the text's own copy allocate again
+*/
+
+class HudText
+{
+private:
+	static const size_t bufferSize = 512;
+
+	char shown[bufferSize]; // what the sf::Text currently displays
+	char pending[bufferSize]; // being built this frame
+	size_t pendingLength = 0;
+
+	sf::String displayString;
+	sf::Text text;
+
+public:
+	HudText()
+	{
+		this->shown[0] = '\0';
+		this->pending[0] = '\0';
+	}
+
+	sf::Text& getText()
+	{
+		return this->text;
+	}
+
+	void begin() // starts a new frame of text
+	{
+		this->pendingLength = 0;
+		this->pending[0] = '\0';
+	}
+
+	void appendf(const char* format, ...) // printf style, anything past the buffer is cut off
+	{
+		if (this->pendingLength >= bufferSize - 1)
+			return;
+
+		va_list args;
+		va_start(args, format);
+		const int written = std::vsnprintf(this->pending + this->pendingLength, bufferSize - this->pendingLength, format, args);
+		va_end(args);
+
+		if (written > 0)
+			this->pendingLength = std::min(bufferSize - 1, this->pendingLength + static_cast<size_t>(written));
+	}
+
+	bool commit() // shows the built text if it changed, returns true when the text was updated
+	{
+		if (std::strcmp(this->pending, this->shown) == 0)
+			return false;
+
+		std::memcpy(this->shown, this->pending, this->pendingLength + 1);
+
+		// single characters fit in the string's small buffer, so only displayString's storage is used
+		this->displayString.clear();
+		for (size_t i = 0; i < this->pendingLength; i++)
+		{
+			this->displayString += sf::String(static_cast<sf::Uint32>(static_cast<unsigned char>(this->pending[i])));
+		}
+
+		this->text.setString(this->displayString);
+		return true;
+	}
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+// std includes
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// SFML includes
+#include <SFML/Graphics.hpp>
+
+// custom includes
+#include "PhysicsSolver.cpp"
+#include "util/thread_pool.h"
+
+/*
+* Image mapped colouring
+* 1. run a scripted scene headless up to targetFrame and note where every ball ends up
+* 2. colour each ball by the image pixel under its final position
+* 3. replay the same script with those colours, the pile settles into the picture
+* This only works because the solver is deterministic: the same script, settings and dt give
+* bit identical positions whatever the thread count, which verifyReplay checks at the end.
+*/
+
+struct ShowcaseScript // deterministic spawning, only depends on the frame number
+{
+	size_t ballCount = 2500;
+	size_t ballsPerFrame = 8;
+	size_t settleFrames = 300; // frames simulated after the last spawn
+	float dt = 1.f / 30.f;
+
+	size_t getTargetFrame() const
+	{
+		return (ballCount + ballsPerFrame - 1) / ballsPerFrame + settleFrames;
+	}
+
+	void spawnFrame(PhysSolver& world, size_t frame) const // a fan of balls thrown down from the top of the collider
+	{
+		const size_t first = frame * ballsPerFrame;
+		const sf::Vector2f spout = world.collider_pos - sf::Vector2f(0.f, world.collider_radius * 0.75f);
+		const float spacing = world.obj_radius * 2.5f;
+
+		for (size_t i = 0; i < ballsPerFrame && first + i < ballCount; i++)
+		{
+			const float offset = (static_cast<float>(i) - (ballsPerFrame - 1) * 0.5f);
+			const float sway = static_cast<float>((frame * 7) % 11) - 5.f; // swings the fan so the pile fills evenly
+			world.addVerletObject(spout + sf::Vector2f(offset * spacing, 0.f), sf::Vector2f((offset + sway) * 40.f, 300.f));
+		}
+	}
+};
+
+class ImageReplay
+{
+private:
+	std::vector<sf::Color> ballColors; // by spawn index
+	std::vector<sf::Vector2f> finalPositions; // from the headless pass, the replay has to match these exactly
+
+	static sf::Color sampleImage(const sf::Image& image, const PhysSolver& world, sf::Vector2f ballPos)
+	{
+		// the collider's bounding square maps onto the whole image
+		const sf::Vector2f center = ballPos + sf::Vector2f(world.obj_radius, world.obj_radius);
+		const sf::Vector2f corner = world.collider_pos - sf::Vector2f(world.collider_radius, world.collider_radius);
+		const float u = (center.x - corner.x) / (world.collider_radius * 2.f);
+		const float v = (center.y - corner.y) / (world.collider_radius * 2.f);
+
+		const sf::Vector2u size = image.getSize();
+		const unsigned int x = static_cast<unsigned int>(std::max(0.f, std::min(size.x - 1.f, u * size.x)));
+		const unsigned int y = static_cast<unsigned int>(std::max(0.f, std::min(size.y - 1.f, v * size.y)));
+
+		sf::Color color = image.getPixel(x, y);
+		if (color.a < 128) // transparent parts of the image keep the default ball colour
+			return sf::Color(50, 50, 50, 255);
+
+		color.a = 255;
+		return color;
+	}
+
+public:
+	ShowcaseScript script;
+
+	// pass 1, simulates the script without rendering in a fresh solver with settingsFrom's settings
+	double computeColors(const sf::Image& image, const PhysSolver& settingsFrom, ThreadPool* pool)
+	{
+		const auto passStart = std::chrono::steady_clock::now();
+
+		PhysSolver world;
+		world.copySettingsFrom(settingsFrom);
+		world.threadPool = pool;
+
+		const size_t targetFrame = this->script.getTargetFrame();
+		for (size_t frame = 0; frame < targetFrame; frame++)
+		{
+			this->script.spawnFrame(world, frame);
+			world.update(this->script.dt);
+		}
+
+		this->ballColors.resize(world.verletObjList.size());
+		this->finalPositions.resize(world.verletObjList.size());
+		for (size_t i = 0; i < world.verletObjList.size(); i++)
+		{
+			this->finalPositions[i] = world.verletObjList[i].curPos;
+			this->ballColors[i] = sampleImage(image, world, this->finalPositions[i]);
+		}
+
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - passStart).count();
+	}
+
+	// pass 2, call in place of update while replaying, spawns and colours the frame's balls then steps the world
+	void replayFrame(PhysSolver& world, size_t frame) const
+	{
+		const size_t firstNew = world.verletObjList.size();
+		this->script.spawnFrame(world, frame);
+		for (size_t i = firstNew; i < world.verletObjList.size() && i < this->ballColors.size(); i++)
+		{
+			world.verletObjList[i].color = this->ballColors[i];
+		}
+
+		world.update(this->script.dt);
+	}
+
+	bool verifyReplay(const PhysSolver& world) const // true if the replay landed every ball bit exactly where pass 1 did
+	{
+		if (world.verletObjList.size() != this->finalPositions.size())
+			return false;
+
+		for (size_t i = 0; i < this->finalPositions.size(); i++)
+		{
+			if (std::memcmp(&world.verletObjList[i].curPos, &this->finalPositions[i], sizeof(sf::Vector2f)) != 0)
+				return false;
+		}
+		return true;
+	}
+};
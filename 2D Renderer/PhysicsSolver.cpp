@@ -2,35 +2,283 @@
 // std includes
 #include <vector>
 #include <iostream>
+#include <limits>
 
 // SFML includes
 #include <SFML/Graphics.hpp>
 
 // custom includes
+#include "GridCollision.h"
 #include "VerletGrid.cpp"
 #include "VerletObject.cpp"
 #include "util/math.h"
+#include "util/task_graph.h"
+#include "util/thread_pool.h"
 
 
+// solver work counters, compiled in with VERLET_SOLVER_COUNTERS so release builds don't pay for them
+#ifdef VERLET_SOLVER_COUNTERS
+#define SOLVER_COUNT(statement) statement
+const bool solverCountersEnabled = true;
+#else
+#define SOLVER_COUNT(statement)
+const bool solverCountersEnabled = false;
+#endif
+
+struct SolverCounters // work done by one update, summed over every substep and thread
+{
+	uint64_t pairsTested = 0; // ball pairs whose distance was checked
+	uint64_t contactsResolved = 0; // pairs that overlapped and were pushed apart
+	uint64_t boundaryHits = 0; // balls clamped back inside the collider
+	uint64_t segmentHits = 0; // balls pushed out of or stopped by a static segment
+	uint64_t sweptTests = 0; // balls fast enough to take the swept segment test
+	uint64_t fieldTests = 0; // balls a force field looked at, only those in the cells it overlaps
+	float maxOverlap = 0.f; // deepest ball / ball overlap seen, px
+
+	void merge(const SolverCounters& other)
+	{
+		pairsTested += other.pairsTested;
+		contactsResolved += other.contactsResolved;
+		boundaryHits += other.boundaryHits;
+		segmentHits += other.segmentHits;
+		sweptTests += other.sweptTests;
+		fieldTests += other.fieldTests;
+		maxOverlap = std::max(maxOverlap, other.maxOverlap);
+	}
+};
+
+struct SolverStats // filled every update, read by the HUD and tools
+{
+	int subSteps = 0; // substeps used for the last frame
+	float maxSpeed = 0.f; // fastest ball at the start of the last frame, px/s
+	SolverCounters counters; // all zero unless solverCountersEnabled
+	const char* kernelName = ""; // substep kernel instantiation used for the last frame
+};
+
+enum class BallColorMode // what the ball colours show, computed on rendered frames only
+{
+	Stored, // each ball's own colour
+	Velocity, // speed, blue (still) to red (velocity_color_scale px/s and up)
+	Pressure, // contacts resolved this frame
+	SpawnOrder, // oldest blue, newest red
+	IdRainbow, // neighbouring ids get unrelated hues
+	Count
+};
+
+inline const char* ballColorModeName(BallColorMode mode)
+{
+	switch (mode)
+	{
+	case BallColorMode::Stored: return "stored";
+	case BallColorMode::Velocity: return "velocity";
+	case BallColorMode::Pressure: return "pressure";
+	case BallColorMode::SpawnOrder: return "spawn order";
+	case BallColorMode::IdRainbow: return "id rainbow";
+	default: return "?";
+	}
+}
+
+struct BallMaterial // per ball physical properties, the defaults reproduce the uniform solver exactly
+{
+	float mass = 1.f; // splits the overlap correction, heavier balls get pushed less
+	float restitution = 0.f; // share of the approach speed given back as bounce, 0 keeps the plain overlap correction
+	float friction = 0.f; // share of the sliding speed removed per contact, 0 to 1
+};
+
+/*
+* Compile time solver policies
+* The substep's hot loops are instantiated for every combination below and PhysSolver picks one per update
+* from what the scene uses (selectSubStepKernels), so a plain scene runs loops with no segment tests and no
+* material lookups compiled in, and the ball radius (PhysSolver::obj_radius) is a constant the compiler folds.
+*/
+
+struct CircleConstraint // the collider circle only
+{
+	static const bool staticSegments = false;
+	static const bool periodic = false;
+};
+
+struct CircleAndSegmentsConstraint // collider circle plus the static segments
+{
+	static const bool staticSegments = true;
+	static const bool periodic = false;
+};
+
+struct PeriodicBoxConstraint // no walls, the grid's box wraps around at its edges
+{
+	static const bool staticSegments = false;
+	static const bool periodic = true;
+};
+
+struct UniformMaterial // every ball has the default BallMaterial
+{
+	static const bool perBall = false;
+};
+
+struct PerBallMaterialColumns // materials read from the solver's columns
+{
+	static const bool perBall = true;
+};
+
+struct SolverKernelConfig // what a scene needs from the kernels, the runtime side of the policies
+{
+	bool staticSegments = false;
+	bool ballMaterials = false;
+	bool periodic = false;
+};
+
+enum class BoundaryMode
+{
+	Collider, // balls sit inside the collider circle
+	Periodic // a box with wrap around edges, for bulk statistics without wall effects
+};
+
+enum class PositionPrecision // how ball positions relate to world coordinates
+{
+	Absolute, // floats hold world coordinates, precision drops with distance from the world origin
+	RegionRelative // floats are relative to the solver's regionOrigin (kept in double), same precision anywhere
+};
+
+inline const char* positionPrecisionName(PositionPrecision precision)
+{
+	switch (precision)
+	{
+	case PositionPrecision::Absolute: return "absolute";
+	case PositionPrecision::RegionRelative: return "region relative";
+	default: return "?";
+	}
+}
+
+enum class ForceFieldType
+{
+	Attractor, // pulls towards the centre
+	Repeller, // pushes away from it
+	Vortex // swirls around it, anticlockwise on screen
+};
+
+struct ForceField // a local force with a finite reach, strongest at the centre and fading linearly to nothing at radius
+{
+	ForceFieldType type = ForceFieldType::Attractor;
+	sf::Vector2f position; // centre in solver coordinates
+	float radius = 100.f;
+	float strength = 3000.f; // acceleration at the centre, px/s^2
+};
+
+struct StaticSegment // thin wall the balls collide with, a == b makes a round peg
+{
+	sf::Vector2f a;
+	sf::Vector2f b;
+	float thickness = 2.f;
+};
+
 struct PhysSolver
 {
 	// physics data
 	sf::Vector2f gravity = {0.0f, 1000.0f}; // x and y gravity
 	sf::CircleShape backgroundCircle; // this circle is basically the white circle in the back, reffered to for data about collisions.
+	sf::RectangleShape backgroundBox; // drawn instead of the circle in periodic mode
+
+	// periodic mode wraps the grid's area, curPos in [periodicOrigin, periodicOrigin + periodicSize), lastPos moves with it
+	BoundaryMode boundaryMode = BoundaryMode::Collider;
+	sf::Vector2f periodicOrigin;
+	sf::Vector2f periodicSize;
 
 	// data collections
-	std::vector<VerletObject*> verletObjList; // list of all the content
-	VerletGrid verletScreenGrid; // verlet grid
+	std::vector<VerletObject> verletObjList; // list of all the content, stored by value so the balls are contiguous and adding one is not a heap allocation each
+	VerletGrid verletScreenGrid; // verlet grid, also the index SpatialQueries.h answers from
+	bool gridDirty = true; // balls were added, removed or moved outside update since the grid was built
+	int nextObjID = 1; // only ever counts up, removing balls reuses their slots but never their ids
+	std::vector<StaticSegment> staticSegments; // static colliders inside the circle
+	std::vector<ForceField> forceFields; // applied every substep, each only to the balls in the grid cells it overlaps
+
+	// optional material columns, empty until a ball gets a non default material, the collision kernel is
+	// compiled twice and the uniform version never touches them
+	std::vector<float> ballInvMass;
+	std::vector<float> ballRestitution;
+	std::vector<float> ballFriction;
+	bool hasBallMaterials = false;
+
+	// optional lifetime column, the simulated time a ball is removed at, empty until a ball is given a lifetime
+	std::vector<float> ballExpiry;
+	bool hasBallLifetimes = false;
+	float simTime = 0.f; // seconds simulated, advanced by update
+
+	// rendering, balls are batched into one textured quad array
+	std::vector<sf::Vertex> ballVertices; // 4 per visible ball, drawn as sf::Quads
+	std::vector<uint32_t> visibleObjIndices; // ball behind every quad, for the colour pass
+	sf::Texture ballTexture; // created on first render so headless solvers never touch OpenGL
+	bool ballTextureReady = false;
+
+	// diagnostic colouring
+	BallColorMode ballColorMode = BallColorMode::Stored;
+	float velocity_color_scale = 600.f; // px/s shown as the hottest colour
+	sf::Color heatPalette[256]; // blue -> cyan -> green -> yellow -> red
+	sf::Color rainbowPalette[256];
+	std::vector<uint16_t> contactCounts; // per ball contacts this frame, only kept up in Pressure mode
+	bool trackContacts = false;
+
+	// density level of detail, above lod_balls_per_pixel visible balls per screen pixel the balls are splatted
+	// into a screen sized density/colour texture instead of drawn one by one
+	float lod_balls_per_pixel = 0.5f;
+	bool densityRenderActive = false; // mode picked by the last render
+	std::vector<uint32_t> densityCount; // per pixel ball count and colour sums
+	std::vector<uint32_t> densityColorSum; // r, g, b per pixel
+	std::vector<sf::Uint8> densityPixels; // rgba uploaded once per frame
+	sf::Texture densityTexture;
+	const unsigned int densityBandRows = 16; // screen rows per parallel splat task
+
+	// threading, the substep is a small task graph so gravity overlaps the grid build
+	ThreadPool* threadPool = nullptr; // optional, runs single threaded without one
+	TaskGraph subStepGraph;
+	float currentSubDt = 0.f; // substep length of the last update, scales curPos - lastPos into a velocity
+	std::vector<float> chunkMaxSpeedSq; // per chunk results of the max speed scan
+	const size_t objChunkSize = 1024; // balls per parallel for chunk
+	const int collisionStripeWidth = 2; // grid columns per collision stripe
+
+	// every thread counts into its own slot, merged into stats.counters once per update
+	struct CounterSlot
+	{
+		SolverCounters counters;
+		char padding[64]; // keeps neighbouring slots off each other's cache line
+	};
+	std::vector<CounterSlot> counterSlots;
+
+	// one instantiation of the substep's hot loops, picked from the scene at the start of every update
+	struct SubStepKernels
+	{
+		void (*collideStripes)(PhysSolver& solver, const CollisionStripes& stripes, size_t first, size_t last, SolverCounters& counters);
+		void (*integrate)(PhysSolver& solver, size_t first, size_t last, SolverCounters& counters);
+		const char* name;
+	};
+	SubStepKernels activeKernels;
 
 	// phys objects data
-	const float sub_steps = 4.f; // phys substeps
-	const float obj_radius = 4.f; // radius of the balls
+	// adaptive substeps, picked per frame so no ball moves more than max_substep_travel * obj_radius per substep
+	int min_sub_steps = 4;
+	int max_sub_steps = 16;
+	float max_substep_travel = 0.5f;
+	SolverStats stats;
+	static constexpr float obj_radius = 4.f; // radius of every ball, the grid, kernels and drawing all read this one constant
 	const float collider_radius = 300.f; // radius of the collider
-	const sf::Vector2f collider_pos = sf::Vector2f(400.f, 300.f);
+	sf::Vector2f collider_pos = sf::Vector2f(400.f, 300.f); // in solver coordinates, move it with placeRegion
+
+	// large worlds, the solver works in floats around regionOrigin and only converts at the edges (spawning, drawing)
+	PositionPrecision positionPrecision = PositionPrecision::RegionRelative;
+	sf::Vector2<double> regionOrigin; // world position of solver coordinate (0, 0)
+	const float collision_response = 0.75f; // fraction of the overlap resolved per substep
+	float ccd_motion_threshold = 0.5f; // balls moving more than this many radii per substep get swept tests against static colliders
 	
 	PhysSolver() // constructor
 	{
+		configureCollider();
+
+		activeKernels = selectSubStepKernels(describeScene());
+		buildSubStepGraph();
+		initColorPalettes();
+	}
 
+	void configureCollider() // builds the circle and the grid around collider_pos
+	{
 		// constructs the circle that determines physics pos and data.
 		sf::CircleShape backgroundCirclet{ collider_radius };
 		backgroundCirclet.setOrigin(collider_radius, collider_radius);
@@ -40,85 +288,1027 @@ struct PhysSolver
 		backgroundCirclet.setPointCount(128);
 
 		this->backgroundCircle = backgroundCirclet;
+
+		// grid over the collider, cells are one ball wide so only neighbouring cells can touch
+		// (positions are the top left of a ball, hence the extra obj_radius)
+		const sf::Vector2f gridOrigin = collider_pos - sf::Vector2f(collider_radius + obj_radius, collider_radius + obj_radius);
+		verletScreenGrid.configure(gridOrigin, sf::Vector2f(collider_radius * 2.f, collider_radius * 2.f), obj_radius * 2.f);
+
+		// the periodic box is exactly the grid, so a wrapped neighbour cell is the one on the opposite edge
+		periodicOrigin = gridOrigin;
+		periodicSize = sf::Vector2f(verletScreenGrid.width * verletScreenGrid.cellSize, verletScreenGrid.height * verletScreenGrid.cellSize);
+		backgroundBox.setPosition(periodicOrigin + sf::Vector2f(obj_radius, obj_radius)); // in ball centre terms
+		backgroundBox.setSize(periodicSize);
+		backgroundBox.setFillColor(sf::Color::White);
+	}
+
+	void placeRegion(sf::Vector2<double> colliderWorldPos, PositionPrecision precision) // moves the whole scene, balls and segments included
+	{
+		const sf::Vector2<double> oldColliderWorld = localToWorld(collider_pos);
+
+		positionPrecision = precision;
+		if (precision == PositionPrecision::RegionRelative)
+		{
+			// the collider keeps its solver coordinates, only the origin moves
+			regionOrigin = colliderWorldPos - sf::Vector2<double>(400.0, 300.0);
+			collider_pos = sf::Vector2f(400.f, 300.f);
+		}
+		else
+		{
+			regionOrigin = sf::Vector2<double>();
+			collider_pos = sf::Vector2f(static_cast<float>(colliderWorldPos.x), static_cast<float>(colliderWorldPos.y));
+		}
+		configureCollider();
+
+		// everything keeps its place relative to the collider
+		const sf::Vector2<double> shiftWorld = colliderWorldPos - oldColliderWorld;
+		for (VerletObject& obj : verletObjList)
+		{
+			obj.curPos = worldToLocal(localToWorld(obj.curPos) + shiftWorld);
+			obj.lastPos = worldToLocal(localToWorld(obj.lastPos) + shiftWorld);
+		}
+		for (StaticSegment& segment : staticSegments)
+		{
+			segment.a = worldToLocal(localToWorld(segment.a) + shiftWorld);
+			segment.b = worldToLocal(localToWorld(segment.b) + shiftWorld);
+		}
+		gridDirty = true;
+	}
+
+	sf::Vector2<double> localToWorld(sf::Vector2f local) const
+	{
+		return regionOrigin + sf::Vector2<double>(local.x, local.y);
+	}
+
+	sf::Vector2f worldToLocal(sf::Vector2<double> world) const
+	{
+		const sf::Vector2<double> local = world - regionOrigin;
+		return sf::Vector2f(static_cast<float>(local.x), static_cast<float>(local.y));
+	}
+
+	~PhysSolver() // deconstructor
+	{
+		clearVerletObjects();
 	}
 
+	PhysSolver(const PhysSolver&) = delete; // owns the balls, so no copies
+	PhysSolver& operator=(const PhysSolver&) = delete;
+
     void addVerletObject(sf::Vector2f pos) // adds a ball to the simulation at a given position
     {
-		VerletObject* newObj = new VerletObject(pos, obj_radius, verletObjList.size() + 1);
-		verletObjList.push_back(newObj);
+		verletObjList.push_back(VerletObject(pos, obj_radius, nextObjID++)); // not emplace_back, it would bind the static obj_radius by reference and need an out of class definition
+		gridDirty = true;
+
+		if (hasBallMaterials) // columns stay the same length as the balls once they exist
+		{
+			const BallMaterial defaults;
+			ballInvMass.push_back(1.f / defaults.mass);
+			ballRestitution.push_back(defaults.restitution);
+			ballFriction.push_back(defaults.friction);
+		}
+
+		if (hasBallLifetimes)
+			ballExpiry.push_back(std::numeric_limits<float>::infinity());
     }
-	
-	void clearVerletObjects() // removes all balls from the simulation
+
+	void addVerletObject(sf::Vector2f pos, sf::Vector2f velocity) // adds a moving ball, velocity in px/s
+	{
+		addVerletObject(pos);
+
+		// velocity is stored as curPos - lastPos over a substep, before the first update assume the fewest substeps
+		const float sub_dt = currentSubDt > 0.f ? currentSubDt : (1.f / 30.f) / static_cast<float>(min_sub_steps);
+		verletObjList.back().lastPos = pos - velocity * sub_dt;
+	}
+
+	void setBallMaterial(size_t objIndex, const BallMaterial& material) // the first call creates the material columns
+	{
+		if (!hasBallMaterials)
+		{
+			const BallMaterial defaults;
+			ballInvMass.assign(verletObjList.size(), 1.f / defaults.mass);
+			ballRestitution.assign(verletObjList.size(), defaults.restitution);
+			ballFriction.assign(verletObjList.size(), defaults.friction);
+			hasBallMaterials = true;
+		}
+
+		ballInvMass[objIndex] = material.mass > 0.f ? 1.f / material.mass : 0.f; // mass 0 pins the ball against other balls
+		ballRestitution[objIndex] = std::max(0.f, std::min(1.f, material.restitution));
+		ballFriction[objIndex] = std::max(0.f, std::min(1.f, material.friction));
+	}
+
+	void setBallLifetime(size_t objIndex, float seconds) // the ball expires that long from now, the first call creates the column
 	{
-		for (VerletObject* obj : verletObjList)
+		if (!hasBallLifetimes)
 		{
-			delete obj;
+			ballExpiry.assign(verletObjList.size(), std::numeric_limits<float>::infinity());
+			hasBallLifetimes = true;
+		}
+
+		ballExpiry[objIndex] = simTime + seconds;
+	}
+
+	bool isBallExpired(size_t objIndex) const
+	{
+		return hasBallLifetimes && ballExpiry[objIndex] <= simTime;
+	}
+
+	template <class ShouldRemove>
+	size_t removeVerletObjectsIf(ShouldRemove shouldRemove) // shouldRemove(index) is asked once per ball in order, survivors keep their order
+	{
+		// compacts in place, the vectors keep their capacity so the freed slots are what the next balls are added into
+		size_t kept = 0;
+		for (size_t i = 0; i < verletObjList.size(); i++)
+		{
+			if (shouldRemove(i))
+				continue;
+
+			if (kept != i)
+			{
+				verletObjList[kept] = verletObjList[i];
+				if (hasBallMaterials)
+				{
+					ballInvMass[kept] = ballInvMass[i];
+					ballRestitution[kept] = ballRestitution[i];
+					ballFriction[kept] = ballFriction[i];
+				}
+				if (hasBallLifetimes)
+					ballExpiry[kept] = ballExpiry[i];
+			}
+			kept++;
 		}
+
+		const size_t removed = verletObjList.size() - kept;
+		gridDirty = gridDirty || removed > 0;
+		verletObjList.erase(verletObjList.begin() + kept, verletObjList.end());
+		if (hasBallMaterials)
+		{
+			ballInvMass.resize(kept);
+			ballRestitution.resize(kept);
+			ballFriction.resize(kept);
+		}
+		if (hasBallLifetimes)
+			ballExpiry.resize(kept);
+		return removed;
+	}
+
+	BallMaterial getBallMaterial(size_t objIndex) const
+	{
+		BallMaterial material;
+		if (hasBallMaterials)
+		{
+			material.mass = ballInvMass[objIndex] > 0.f ? 1.f / ballInvMass[objIndex] : 0.f;
+			material.restitution = ballRestitution[objIndex];
+			material.friction = ballFriction[objIndex];
+		}
+		return material;
+	}
+
+	void copySettingsFrom(const PhysSolver& other) // everything that affects the simulation except the balls
+	{
+		if (other.positionPrecision != positionPrecision || other.regionOrigin != regionOrigin || other.collider_pos != collider_pos)
+			placeRegion(other.localToWorld(other.collider_pos), other.positionPrecision);
+		gravity = other.gravity;
+		boundaryMode = other.boundaryMode;
+		staticSegments = other.staticSegments;
+		forceFields = other.forceFields;
+		min_sub_steps = other.min_sub_steps;
+		max_sub_steps = other.max_sub_steps;
+		max_substep_travel = other.max_substep_travel;
+		ccd_motion_threshold = other.ccd_motion_threshold;
+	}
+	
+	void setBoundaryMode(BoundaryMode mode) // balls outside the new boundary are brought back by the next update
+	{
+		boundaryMode = mode;
+		gridDirty = true;
+	}
+
+	void addStaticSegment(sf::Vector2f a, sf::Vector2f b, float thickness) // adds a static wall between two points
+	{
+		StaticSegment segment;
+		segment.a = a;
+		segment.b = b;
+		segment.thickness = thickness;
+		staticSegments.push_back(segment);
+	}
+
+	void clearStaticSegments()
+	{
+		staticSegments.clear();
+	}
+
+	void clearVerletObjects() // removes all balls from the simulation
+	{
 		verletObjList.clear();
 		verletObjList.shrink_to_fit();
+		ballInvMass.clear();
+		ballRestitution.clear();
+		ballFriction.clear();
+		hasBallMaterials = false;
+		ballExpiry.clear();
+		hasBallLifetimes = false;
+		nextObjID = 1;
+		gridDirty = true;
+		currentSubDt = 0.f; // no velocities left to keep, the next run starts like a fresh solver
+	}
+
+	void buildSubStepGraph() // gravity || grid build -> force fields -> collision colour 0 -> collision colour 1 -> integrate + constrain
+	{
+		const size_t gravityTask = subStepGraph.addTask([this]() {
+			forEachObjChunk([this](size_t first, size_t last) {
+				AccelerateBodies(verletObjList.data(), first, last, gravity);
+			});
+		});
+
+		const size_t gridTask = subStepGraph.addTask([this]() { buildCollisionGrid(); });
+		const size_t fieldsTask = subStepGraph.addTask([this]() { applyForceFields(); });
+		const size_t evenStripesTask = subStepGraph.addTask([this]() { applyBallCollisions(0); });
+		const size_t oddStripesTask = subStepGraph.addTask([this]() { applyBallCollisions(1); });
+
+		const size_t integrateTask = subStepGraph.addTask([this]() {
+			forEachObjChunk([this](size_t first, size_t last) {
+				activeKernels.integrate(*this, first, last, localCounters());
+			});
+		});
+
+		subStepGraph.addDependency(gridTask, fieldsTask); // fields find their balls through the grid
+		subStepGraph.addDependency(gravityTask, fieldsTask); // both add to the acceleration
+		subStepGraph.addDependency(fieldsTask, evenStripesTask); // and read the positions the collisions move
+		subStepGraph.addDependency(evenStripesTask, oddStripesTask);
+		subStepGraph.addDependency(oddStripesTask, integrateTask);
+		subStepGraph.addDependency(gravityTask, integrateTask);
+	}
+
+	SolverKernelConfig describeScene() const
+	{
+		SolverKernelConfig config;
+		config.staticSegments = !staticSegments.empty();
+		config.ballMaterials = hasBallMaterials;
+		config.periodic = boundaryMode == BoundaryMode::Periodic;
+		return config;
+	}
+
+	template <class Constraint, class Material>
+	static SubStepKernels makeSubStepKernels(const char* name)
+	{
+		SubStepKernels kernels;
+		kernels.collideStripes = [](PhysSolver& solver, const CollisionStripes& stripes, size_t first, size_t last, [[maybe_unused]] SolverCounters& threadCounters) {
+			solver.solveStripeRange<Material::perBall, Constraint::periodic>(stripes, first, last, threadCounters);
+		};
+		kernels.integrate = [](PhysSolver& solver, size_t first, size_t last, [[maybe_unused]] SolverCounters& threadCounters) {
+			solver.integrateRange<Constraint>(first, last, threadCounters);
+		};
+		kernels.name = name;
+		return kernels;
+	}
+
+	static SubStepKernels selectSubStepKernels(const SolverKernelConfig& config) // runtime factory over the policy instantiations
+	{
+		if (config.periodic) // static segments don't wrap, so the periodic box ignores them
+		{
+			if (config.ballMaterials)
+				return makeSubStepKernels<PeriodicBoxConstraint, PerBallMaterialColumns>("periodic + materials");
+			return makeSubStepKernels<PeriodicBoxConstraint, UniformMaterial>("periodic");
+		}
+
+		if (config.staticSegments)
+		{
+			if (config.ballMaterials)
+				return makeSubStepKernels<CircleAndSegmentsConstraint, PerBallMaterialColumns>("segments + materials");
+			return makeSubStepKernels<CircleAndSegmentsConstraint, UniformMaterial>("segments");
+		}
+
+		if (config.ballMaterials)
+			return makeSubStepKernels<CircleConstraint, PerBallMaterialColumns>("materials");
+		return makeSubStepKernels<CircleConstraint, UniformMaterial>("uniform");
+	}
+
+	template <class Func>
+	void forEachObjChunk(Func&& func) // func(first, last) over every ball, in parallel when there is a pool
+	{
+		ForEachChunk(threadPool, verletObjList.size(), objChunkSize, func);
 	}
 
 	void update(float dt) // updates the simulation
 	{
-		const float sub_dt = dt / sub_steps;
+		const int sub_steps = chooseSubSteps(dt);
+		const float sub_dt = dt / static_cast<float>(sub_steps);
+
+		if (currentSubDt > 0.f && sub_dt != currentSubDt) // velocity lives in curPos - lastPos, keep it the same when the step changes
+			rescaleVelocities(sub_dt / currentSubDt);
+
+		currentSubDt = sub_dt;
+		simTime += dt;
+
+		activeKernels = selectSubStepKernels(describeScene());
+		stats.kernelName = activeKernels.name;
+
+		trackContacts = ballColorMode == BallColorMode::Pressure;
+		if (trackContacts)
+			contactCounts.assign(verletObjList.size(), 0);
+
+		const size_t slotCount = threadPool ? threadPool->getThreadCount() + 1 : 1;
+		counterSlots.resize(std::max(counterSlots.size(), slotCount));
+		SOLVER_COUNT(for (CounterSlot& slot : counterSlots) slot.counters = SolverCounters();)
+
 		for (size_t i(sub_steps); i--;)
 		{
-			for (VerletObject* obj : verletObjList)
+			subStepGraph.run(threadPool);
+		}
+
+		stats.counters = SolverCounters();
+		SOLVER_COUNT(for (const CounterSlot& slot : counterSlots) stats.counters.merge(slot.counters);)
+
+		// queries and culling widen their search by a cell for movement since the grid was built, if balls can have moved
+		// further than that in the last substep (the substep cap was hit) the grid has to be rebuilt before it is used
+		gridDirty = stats.maxSpeed * sub_dt > verletScreenGrid.cellSize;
+	}
+
+	SolverCounters& localCounters() // the calling thread's slot, only valid during update
+	{
+		return counterSlots[threadPool ? threadPool->currentThreadSlot() : 0].counters;
+	}
+
+	int chooseSubSteps(float dt) // CFL style, enough substeps for the fastest ball to stay under max_substep_travel radii per substep
+	{
+		float maxSpeedSq = 0.f;
+		if (currentSubDt > 0.f && !verletObjList.empty())
+		{
+			chunkMaxSpeedSq.assign((verletObjList.size() + objChunkSize - 1) / objChunkSize, 0.f);
+			forEachObjChunk([this](size_t first, size_t last) {
+				float chunkMax = 0.f;
+				for (size_t i = first; i < last; i++)
+				{
+					const sf::Vector2f v = verletObjList[i].curPos - verletObjList[i].lastPos;
+					chunkMax = std::max(chunkMax, v.x * v.x + v.y * v.y);
+				}
+				chunkMaxSpeedSq[first / objChunkSize] = chunkMax;
+			});
+
+			for (float chunkMax : chunkMaxSpeedSq)
 			{
-				applyGravity(*obj);
-				applyConstraint(*obj);
+				maxSpeedSq = std::max(maxSpeedSq, chunkMax);
 			}
+			maxSpeedSq /= currentSubDt * currentSubDt;
+		}
 
-			applyBallCollisions();
+		const float frameTravel = std::sqrt(maxSpeedSq) * dt;
+		const int wanted = static_cast<int>(std::ceil(frameTravel / (max_substep_travel * obj_radius)));
 
-			for (VerletObject* obj : verletObjList)
+		stats.maxSpeed = std::sqrt(maxSpeedSq);
+		stats.subSteps = std::min(max_sub_steps, std::max(min_sub_steps, wanted));
+		return stats.subSteps;
+	}
+
+	void rescaleVelocities(float ratio)
+	{
+		forEachObjChunk([this, ratio](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+			{
+				VerletObject& obj = verletObjList[i];
+				obj.lastPos = obj.curPos - (obj.curPos - obj.lastPos) * ratio;
+			}
+		});
+	}
+
+	void buildCollisionGrid() // sorts every ball into the grid
+	{
+		verletScreenGrid.resetGridContent(verletObjList.size());
+		forEachObjChunk([this](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
 			{
-				obj->updatePosition(sub_dt);
+				verletScreenGrid.addVerletObjToGrid(verletObjList[i], static_cast<uint32_t>(i));
 			}
+		});
+		verletScreenGrid.finishGridContent();
+		gridDirty = false;
+	}
+
+	void refreshSpatialIndex() // rebuilds the grid if it no longer matches the balls, call before querying outside update
+	{
+		if (gridDirty || verletScreenGrid.objectCell.size() != verletObjList.size())
+			buildCollisionGrid();
+	}
+
+	void applyBallCollisions(int stripeColour) // resolves overlaps in every other stripe of grid columns, see CollisionStripes
+	{
+		const CollisionStripes stripes(verletScreenGrid.width, collisionStripeWidth, stripeColour);
+
+		// wrapping, the last stripe reaches into column 0, which is only safe while the two have different colours
+		const bool wrapShared = boundaryMode == BoundaryMode::Periodic && stripes.stripeCount() % 2 == 1;
+		stripes.run(threadPool, wrapShared, [this, &stripes](size_t first, size_t last) {
+			activeKernels.collideStripes(*this, stripes, first, last, localCounters());
+		});
+	}
+
+	template <bool PerBallMaterial, bool Periodic>
+	void solveStripeRange(const CollisionStripes& stripes, size_t first, size_t last, [[maybe_unused]] SolverCounters& threadCounters) // stripes [first, last) of one colour
+	{
+		auto contact = [this, &threadCounters](uint32_t a, uint32_t b, sf::Vector2f ghostShift, bool wrapped) {
+			if (wrapped)
+				solveContact<PerBallMaterial, true>(a, b, ghostShift, threadCounters);
+			else
+				solveContact<PerBallMaterial, false>(a, b, ghostShift, threadCounters);
+		};
+
+		stripes.forEachColumn(first, last, [&](int x) {
+			verletScreenGrid.forEachCellInColumn(x, [&](sf::Vector2i cell) {
+				CollideCell<Periodic>(verletScreenGrid, cell, periodicSize, contact);
+			});
+		});
+	}
+
+	template <bool PerBallMaterial, bool Ghost>
+	void solveContact(uint32_t aIndex, uint32_t bIndex, sf::Vector2f ghostShift, [[maybe_unused]] SolverCounters& threadCounters) // pushes two overlapping balls apart, b seen at curPos + ghostShift when Ghost
+	{
+		VerletObject& a = verletObjList[aIndex];
+		VerletObject& b = verletObjList[bIndex];
+		const float minDist = obj_radius * 2.f;
+		SOLVER_COUNT(threadCounters.pairsTested++;)
+
+		float overlap = 0.f;
+		if (!PerBallMaterial) // equal masses share the correction, same kernel as the 3D solver
+		{
+			const bool touching = Ghost
+				? ResolveBallOverlapAlong(a, b, a.curPos - (b.curPos + ghostShift), minDist, collision_response, overlap)
+				: ResolveBallOverlap(a, b, minDist, collision_response, overlap);
+			if (!touching)
+				return;
+		}
+		else
+		{
+			const sf::Vector2f v = Ghost ? a.curPos - (b.curPos + ghostShift) : a.curPos - b.curPos;
+			const float distSq = v.x * v.x + v.y * v.y;
+			if (distSq >= minDist * minDist || distSq <= 1e-8f)
+				return;
+
+			const float dist = std::sqrt(distSq);
+			overlap = minDist - dist;
+			solveMaterialContact(aIndex, bIndex, v / dist, collision_response * overlap);
 		}
+
+		SOLVER_COUNT(threadCounters.contactsResolved++;)
+		SOLVER_COUNT(threadCounters.maxOverlap = std::max(threadCounters.maxOverlap, overlap);)
+		if (trackContacts) // same stripe rules as the positions, so no races
+		{
+			contactCounts[aIndex]++;
+			contactCounts[bIndex]++;
+		}
+	}
+
+	void solveMaterialContact(uint32_t aIndex, uint32_t bIndex, sf::Vector2f n, float correction) // mass weighted push, then bounce and friction on the velocities
+	{
+		VerletObject& a = verletObjList[aIndex];
+		VerletObject& b = verletObjList[bIndex];
+		const float invMassA = ballInvMass[aIndex];
+		const float invMassB = ballInvMass[bIndex];
+		const float invMassSum = invMassA + invMassB;
+		if (invMassSum <= 0.f) // two pinned balls
+			return;
+
+		const float shareA = invMassA / invMassSum;
+		const float shareB = invMassB / invMassSum;
+		a.curPos += n * (correction * shareA);
+		b.curPos -= n * (correction * shareB);
+
+		const float restitution = 0.5f * (ballRestitution[aIndex] + ballRestitution[bIndex]);
+		const float friction = 0.5f * (ballFriction[aIndex] + ballFriction[bIndex]);
+		if (restitution <= 0.f && friction <= 0.f)
+			return;
+
+		// velocities live in curPos - lastPos, so changing one means moving lastPos the other way
+		const sf::Vector2f relative = (a.curPos - a.lastPos) - (b.curPos - b.lastPos);
+		const float normalSpeed = Dot2D(relative, n);
+		if (normalSpeed >= 0.f) // already separating
+			return;
+
+		const sf::Vector2f tangential = relative - n * normalSpeed;
+		const sf::Vector2f change = n * (-restitution * normalSpeed) - tangential * friction;
+		a.lastPos -= change * shareA;
+		b.lastPos += change * shareB;
 	}
 
-	void applyBallCollisions()
+	void applyForceFields() // one field at a time, the rows of cells a field covers are split across the pool
 	{
-		// first we need to setup and organize all the data for each of the balls
-		verletScreenGrid.resetGridContent();
-		for (VerletObject* obj : verletObjList)
+		const VerletGrid& grid = verletScreenGrid;
+		for (const ForceField& field : forceFields)
 		{
-			verletScreenGrid.addVerletObjToGrid(obj);
+			// the grid was built from these positions this substep, so no margin is needed, only the shift
+			// from ball centres to the top left positions the cells are binned by
+			const sf::Vector2f low = field.position - sf::Vector2f(field.radius + obj_radius, field.radius + obj_radius);
+			const sf::Vector2f high = field.position + sf::Vector2f(field.radius - obj_radius, field.radius - obj_radius);
+			const int x0 = grid.cellX(low.x);
+			const int x1 = grid.cellX(high.x);
+			const int y0 = grid.cellY(low.y);
+			const int y1 = grid.cellY(high.y);
+
+			auto applyRows = [this, &field, &grid, x0, x1, y0](size_t first, size_t last) {
+				for (size_t row = first; row < last; row++)
+				{
+					// a row of cells is contiguous in cellObjects
+					const size_t rowStart = (y0 + row) * grid.width;
+					applyFieldToBalls(field, grid.cellObjects.data() + grid.cellStart[rowStart + x0], grid.cellObjects.data() + grid.cellStart[rowStart + x1 + 1], localCounters());
+				}
+			};
+
+			const size_t rows = static_cast<size_t>(y1 - y0 + 1);
+			if (threadPool)
+				threadPool->parallelFor(0, rows, 8, applyRows);
+			else
+				applyRows(0, rows);
 		}
+	}
 
+	void applyFieldToBalls(const ForceField& field, const uint32_t* first, const uint32_t* last, [[maybe_unused]] SolverCounters& threadCounters)
+	{
+		// the field type only picks the mix of the radial and the swirling direction, so the loop has no branches
+		const float radial = field.type == ForceFieldType::Attractor ? 1.f : field.type == ForceFieldType::Repeller ? -1.f : 0.f;
+		const float swirl = field.type == ForceFieldType::Vortex ? 1.f : 0.f;
+		const sf::Vector2f center = field.position - sf::Vector2f(obj_radius, obj_radius); // in top left terms like curPos
+		const float invRadius = 1.f / field.radius;
 
+		for (const uint32_t* objIndex = first; objIndex != last; objIndex++)
+		{
+			VerletObject& obj = verletObjList[*objIndex];
+			const sf::Vector2f d = center - obj.curPos;
+			const float dist = std::sqrt(Dot2D(d, d));
+			const float falloff = std::max(0.f, 1.f - dist * invRadius);
+			const float scale = dist > 1e-4f ? field.strength * falloff / dist : 0.f;
+			obj.acceleration += sf::Vector2f(radial * d.x - swirl * d.y, radial * d.y + swirl * d.x) * scale;
+		}
+		SOLVER_COUNT(threadCounters.fieldTests += static_cast<uint64_t>(last - first);)
 	}
 
-	void applyGravity(VerletObject& obj) // applys gravity to a given object
+	template <class Constraint>
+	void integrateRange(size_t first, size_t last, [[maybe_unused]] SolverCounters& threadCounters) // moves balls [first, last) and applies the constraints
 	{
-		obj.accelerate(this->gravity);
+		IntegrateBodies(verletObjList.data(), first, last, currentSubDt, [this, &threadCounters](VerletObject& obj) {
+			applyConstraint<Constraint>(obj, threadCounters);
+		});
 	}
 
-	void applyConstraint(VerletObject& obj) // apply enviromental constraint, like the circle the balls sit inside
+	template <class Constraint>
+	void applyConstraint(VerletObject& obj, [[maybe_unused]] SolverCounters& threadCounters) // apply enviromental constraint, like the circle the balls sit inside
 	{
+		if (Constraint::periodic)
+		{
+			wrapIntoPeriodicBox(obj, threadCounters);
+			return;
+		}
+
 		// Circular Constraint
-		const sf::Vector2f position = (this->backgroundCircle.getPosition() - sf::Vector2f(obj_radius, obj_radius));
-		const float radius = this->backgroundCircle.getRadius();
+		const sf::Vector2f position = (this->collider_pos - sf::Vector2f(obj_radius, obj_radius));
+		const float radius = this->collider_radius;
+
+		const float objRad = obj_radius;
+		if (ConstrainInsideSphere(obj, position, radius - objRad))
+		{
+			SOLVER_COUNT(threadCounters.boundaryHits++;)
+		}
+
+		// Static segments
+		if (Constraint::staticSegments)
+		{
+			const sf::Vector2f motion = obj.curPos - obj.lastPos;
+			const float maxMotion = ccd_motion_threshold * objRad;
+			if (Dot2D(motion, motion) > maxMotion * maxMotion)
+			{
+				SOLVER_COUNT(threadCounters.sweptTests++;)
+				sweepStaticSegments(obj, objRad, threadCounters);
+			}
+			else
+				pushOutOfStaticSegments(obj, objRad, threadCounters);
+		}
+	}
+
+	void wrapIntoPeriodicBox(VerletObject& obj, [[maybe_unused]] SolverCounters& threadCounters) // lastPos moves by the same amount so the velocity carries over the edge
+	{
+		sf::Vector2f shift;
+		if (obj.curPos.x < periodicOrigin.x)
+			shift.x = periodicSize.x;
+		else if (obj.curPos.x >= periodicOrigin.x + periodicSize.x)
+			shift.x = -periodicSize.x;
+		if (obj.curPos.y < periodicOrigin.y)
+			shift.y = periodicSize.y;
+		else if (obj.curPos.y >= periodicOrigin.y + periodicSize.y)
+			shift.y = -periodicSize.y;
+
+		if (shift.x != 0.f || shift.y != 0.f)
+		{
+			obj.curPos += shift;
+			obj.lastPos += shift;
+			SOLVER_COUNT(threadCounters.boundaryHits++;)
+		}
+	}
+
+	void pushOutOfStaticSegments(VerletObject& obj, float objRad, [[maybe_unused]] SolverCounters& threadCounters) // discrete path, resolves any overlap at the current position
+	{
+		const sf::Vector2f centerOffset(objRad, objRad); // positions are the top left of the ball
+		for (const StaticSegment& segment : staticSegments)
+		{
+			const sf::Vector2f center = obj.curPos + centerOffset;
+			const float minDist = objRad + segment.thickness * 0.5f;
+			const sf::Vector2f v = center - ClosestPointOnSegment2D(center, segment.a, segment.b);
+			const float distSq = Dot2D(v, v);
+			if (distSq < minDist * minDist && distSq > 1e-8f)
+			{
+				const float dist = std::sqrt(distSq);
+				obj.curPos += v * ((minDist - dist) / dist);
+				SOLVER_COUNT(threadCounters.segmentHits++;)
+			}
+		}
+	}
+
+	void sweepStaticSegments(VerletObject& obj, float objRad, [[maybe_unused]] SolverCounters& threadCounters) // continuous path, stops fast balls at the first segment they would pass through
+	{
+		const sf::Vector2f centerOffset(objRad, objRad);
+		const sf::Vector2f start = obj.lastPos + centerOffset;
+		const sf::Vector2f end = obj.curPos + centerOffset;
+		const sf::Vector2f motion = end - start;
+
+		float firstHit = 2.f;
+		sf::Vector2f hitNormal;
+		for (const StaticSegment& segment : staticSegments)
+		{
+			// the ball's center against the segment grown by the ball radius (a capsule): two sides and two caps
+			const float capsuleRadius = objRad + segment.thickness * 0.5f;
+			const sf::Vector2f seg = segment.b - segment.a;
+			const float segLen = std::sqrt(Dot2D(seg, seg));
+
+			if (segLen > 1e-6f)
+			{
+				const sf::Vector2f dir = seg / segLen;
+				const sf::Vector2f normal(-dir.y, dir.x);
+				const float d0 = Dot2D(start - segment.a, normal);
+				const float d1 = Dot2D(end - segment.a, normal);
+				const float side = d0 >= 0.f ? 1.f : -1.f; // the side the ball comes from
+
+				if (d0 * side >= capsuleRadius && d1 * side < capsuleRadius)
+				{
+					const float t = (d0 * side - capsuleRadius) / ((d0 - d1) * side);
+					const float along = Dot2D(start + motion * t - segment.a, dir);
+					if (along >= 0.f && along <= segLen && t < firstHit)
+					{
+						firstHit = t;
+						hitNormal = normal * side;
+					}
+				}
+			}
+
+			const sf::Vector2f caps[2] = { segment.a, segment.b };
+			for (const sf::Vector2f& cap : caps)
+			{
+				const float t = RayCircleHit2D(start, end, cap, capsuleRadius);
+				if (t >= 0.f && t < firstHit)
+				{
+					firstHit = t;
+					hitNormal = (start + motion * t - cap) / capsuleRadius;
+				}
+			}
+		}
+
+		if (firstHit > 1.f)
+		{
+			pushOutOfStaticSegments(obj, objRad, threadCounters); // may already be touching something it isn't moving into
+			return;
+		}
+
+		// stop at the contact and keep only the velocity along the wall
+		const sf::Vector2f velocity = obj.curPos - obj.lastPos;
+		const sf::Vector2f tangential = velocity - hitNormal * Dot2D(velocity, hitNormal);
+		obj.curPos = start + motion * firstHit - centerOffset;
+		obj.lastPos = obj.curPos - tangential;
+		SOLVER_COUNT(threadCounters.segmentHits++;)
+	}
+
+	void initBallTexture() // white anti aliased disc, tinted per ball through the vertex colour
+	{
+		const unsigned int size = 64;
+		const float half = size * 0.5f;
+
+		sf::Image disc;
+		disc.create(size, size, sf::Color::Transparent);
+		for (unsigned int y = 0; y < size; y++)
+		{
+			for (unsigned int x = 0; x < size; x++)
+			{
+				const float dist = EuclideanDist2D(sf::Vector2f(x + 0.5f, y + 0.5f), sf::Vector2f(half, half));
+				const float coverage = std::max(0.f, std::min(1.f, half - dist));
+				disc.setPixel(x, y, sf::Color(255, 255, 255, static_cast<sf::Uint8>(coverage * 255.f)));
+			}
+		}
+
+		ballTexture.loadFromImage(disc);
+		ballTexture.setSmooth(true);
+		ballTextureReady = true;
+	}
+
+	void appendBallQuad(const VerletObject& obj, uint32_t objIndex) // colour is filled in later by shadeVisibleBalls
+	{
+		const float size = obj.radius * 2.f;
+		const float tex = static_cast<float>(ballTexture.getSize().x);
+		const sf::Vector2f p = obj.curPos; // top left of the ball
+
+		ballVertices.push_back(sf::Vertex(p, sf::Vector2f(0.f, 0.f)));
+		ballVertices.push_back(sf::Vertex(p + sf::Vector2f(size, 0.f), sf::Vector2f(tex, 0.f)));
+		ballVertices.push_back(sf::Vertex(p + sf::Vector2f(size, size), sf::Vector2f(tex, tex)));
+		ballVertices.push_back(sf::Vertex(p + sf::Vector2f(0.f, size), sf::Vector2f(0.f, tex)));
+		visibleObjIndices.push_back(objIndex);
+	}
+
+	void initColorPalettes()
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			// heat: four linear pieces through blue, cyan, green, yellow, red
+			const float t = i / 255.f * 4.f;
+			const int piece = std::min(3, static_cast<int>(t));
+			const sf::Uint8 ramp = static_cast<sf::Uint8>((t - piece) * 255.f);
+			const sf::Color heat[4] = {
+				sf::Color(0, ramp, 255), sf::Color(0, 255, static_cast<sf::Uint8>(255 - ramp)),
+				sf::Color(ramp, 255, 0), sf::Color(255, static_cast<sf::Uint8>(255 - ramp), 0)
+			};
+			heatPalette[i] = heat[piece];
 
-		const float objRad = obj.shape.getRadius();
-		const sf::Vector2f v = position - obj.curPos;
-		const float        dist = sqrt(v.x * v.x + v.y * v.y);
-		if (dist > (radius - objRad)) {
-			const sf::Vector2f n = v / dist;
-			obj.curPos = position - n * (radius - objRad);
+			// rainbow: full saturation hue wheel
+			const float h = i / 256.f * 6.f;
+			const int sector = static_cast<int>(h);
+			const sf::Uint8 up = static_cast<sf::Uint8>((h - sector) * 255.f);
+			const sf::Uint8 down = static_cast<sf::Uint8>(255 - up);
+			const sf::Color hue[6] = {
+				sf::Color(255, up, 0), sf::Color(down, 255, 0), sf::Color(0, 255, up),
+				sf::Color(0, down, 255), sf::Color(up, 0, 255), sf::Color(255, 0, down)
+			};
+			rainbowPalette[i] = hue[sector];
 		}
+	}
+
+	template <class ColorOf>
+	void shadeQuads(ColorOf colorOf) // one tight loop per mode, writes the colour into the 4 vertices of every visible ball
+	{
+		auto shade = [this, &colorOf](size_t first, size_t last) {
+			sf::Vertex* vertices = ballVertices.data();
+			const uint32_t* indices = visibleObjIndices.data();
+			for (size_t quad = first; quad < last; quad++)
+			{
+				const sf::Color color = colorOf(indices[quad]);
+				vertices[quad * 4 + 0].color = color;
+				vertices[quad * 4 + 1].color = color;
+				vertices[quad * 4 + 2].color = color;
+				vertices[quad * 4 + 3].color = color;
+			}
+		};
 
-		// TODO: Other Constraints?
+		if (threadPool)
+			threadPool->parallelFor(0, visibleObjIndices.size(), objChunkSize * 4, shade);
+		else
+			shade(0, visibleObjIndices.size());
 	}
 
-	void render(sf::RenderWindow* window)
+	// calls colorize(colorOf) once, colorOf(i) is ball i's colour in the current ballColorMode. Every mode is its own colorOf
+	// type, so the caller's loop over the balls is instantiated once per mode and stays tight. Read only, callers may run it
+	// on several threads at once.
+	template <class Colorize>
+	void withBallColors(Colorize&& colorize) const
 	{
-		window->draw(backgroundCircle);
+		const std::vector<VerletObject>& objs = verletObjList;
+		switch (ballColorMode)
+		{
+		case BallColorMode::Velocity:
+		{
+			const float toIndex = currentSubDt > 0.f ? 255.f / (velocity_color_scale * currentSubDt) : 0.f;
+			colorize([&](uint32_t i) {
+				const sf::Vector2f v = objs[i].curPos - objs[i].lastPos;
+				return heatPalette[std::min(255, static_cast<int>(std::sqrt(v.x * v.x + v.y * v.y) * toIndex))];
+			});
+			break;
+		}
+		case BallColorMode::Pressure:
+		{
+			// a ball resting in a hex packing touches 6 others every substep
+			const float toIndex = 255.f / (6.f * std::max(1, stats.subSteps));
+			const bool haveCounts = contactCounts.size() == objs.size();
+			colorize([&](uint32_t i) {
+				return heatPalette[haveCounts ? std::min(255, static_cast<int>(contactCounts[i] * toIndex)) : 0];
+			});
+			break;
+		}
+		case BallColorMode::SpawnOrder:
+		{
+			const float toIndex = 255.f / std::max<size_t>(1, objs.size());
+			colorize([&](uint32_t i) { return heatPalette[std::min(255, static_cast<int>(i * toIndex))]; });
+			break;
+		}
+		case BallColorMode::IdRainbow:
+			colorize([&](uint32_t i) { return rainbowPalette[(static_cast<uint32_t>(objs[i].objID) * 97u) & 255u]; });
+			break;
+		default:
+			colorize([&](uint32_t i) { return objs[i].color; });
+			break;
+		}
+	}
+
+	void shadeVisibleBalls()
+	{
+		withBallColors([this](auto colorOf) {
+			shadeQuads(colorOf);
+		});
+	}
+
+	struct CellRange // inclusive grid cell bounds
+	{
+		int x0, x1, y0, y1;
+	};
+
+	CellRange visibleCells(const sf::FloatRect& visible) // cells that can hold a ball overlapping the rect
+	{
+		// the grid is from the last substep, rebuild it if balls were added/cleared since
+		refreshSpatialIndex();
+
+		// a ball covers curPos .. curPos + 2r, and may have moved up to a cell since the grid was built
+		const float margin = obj_radius * 2.f + verletScreenGrid.cellSize;
+		CellRange range;
+		range.x0 = verletScreenGrid.cellX(visible.left - margin);
+		range.x1 = verletScreenGrid.cellX(visible.left + visible.width + margin);
+		range.y0 = verletScreenGrid.cellY(visible.top - margin);
+		range.y1 = verletScreenGrid.cellY(visible.top + visible.height + margin);
+		return range;
+	}
+
+	size_t countBallsInCells(const CellRange& range) const // a row of cells is contiguous in cellObjects
+	{
+		size_t count = 0;
+		for (int y = range.y0; y <= range.y1; y++)
+		{
+			const size_t rowStart = static_cast<size_t>(y) * verletScreenGrid.width;
+			count += verletScreenGrid.cellStart[rowStart + range.x1 + 1] - verletScreenGrid.cellStart[rowStart + range.x0];
+		}
+		return count;
+	}
+
+	void buildVisibleBallQuads(const CellRange& range) // only walks the grid cells that overlap the view
+	{
+		ballVertices.clear();
+		visibleObjIndices.clear();
+
+		for (int y = range.y0; y <= range.y1; y++)
+		{
+			for (int x = range.x0; x <= range.x1; x++)
+			{
+				for (uint32_t objIndex : verletScreenGrid.getCell(x, y))
+				{
+					appendBallQuad(verletObjList[objIndex], objIndex);
+				}
+			}
+		}
+
+		shadeVisibleBalls();
+	}
+
+	void splatDensityBand(unsigned int band, const CellRange& range, const sf::FloatRect& visible, sf::Vector2u pixels)
+	{
+		const unsigned int rowStart = band * densityBandRows;
+		const unsigned int rowEnd = std::min(rowStart + densityBandRows, pixels.y);
+		const float toPixelX = pixels.x / visible.width;
+		const float toPixelY = pixels.y / visible.height;
+
+		std::fill(densityCount.begin() + rowStart * pixels.x, densityCount.begin() + rowEnd * pixels.x, 0u);
+		std::fill(densityColorSum.begin() + rowStart * pixels.x * 3, densityColorSum.begin() + rowEnd * pixels.x * 3, 0u);
+
+		// only the cell rows that can land in this band, balls on a shared cell row are checked by both bands
+		const float margin = verletScreenGrid.cellSize;
+		const int cellRow0 = std::max(range.y0, verletScreenGrid.cellY(visible.top + rowStart / toPixelY - obj_radius - margin));
+		const int cellRow1 = std::min(range.y1, verletScreenGrid.cellY(visible.top + rowEnd / toPixelY - obj_radius + margin));
+
+		const sf::Vector2f centerOffset(obj_radius, obj_radius);
+		withBallColors([&](auto colorOf) {
+			for (int y = cellRow0; y <= cellRow1; y++)
+			{
+				for (int x = range.x0; x <= range.x1; x++)
+				{
+					for (uint32_t objIndex : verletScreenGrid.getCell(x, y))
+					{
+						const sf::Vector2f center = verletObjList[objIndex].curPos + centerOffset;
+						const float px = (center.x - visible.left) * toPixelX;
+						const float py = (center.y - visible.top) * toPixelY;
+						if (px < 0.f || py < static_cast<float>(rowStart) || px >= static_cast<float>(pixels.x) || py >= static_cast<float>(rowEnd))
+							continue;
+
+						const size_t pixel = static_cast<size_t>(py) * pixels.x + static_cast<size_t>(px);
+						const sf::Color color = colorOf(objIndex);
+						densityCount[pixel]++;
+						densityColorSum[pixel * 3 + 0] += color.r;
+						densityColorSum[pixel * 3 + 1] += color.g;
+						densityColorSum[pixel * 3 + 2] += color.b;
+					}
+				}
+			}
+		});
+
+		// resolve to rgba, average colour with alpha from how much of the pixel the balls would cover
+		const float ballPixelArea = 3.14159265f * obj_radius * obj_radius * toPixelX * toPixelY;
+		for (size_t pixel = rowStart * pixels.x; pixel < rowEnd * pixels.x; pixel++)
+		{
+			const uint32_t count = densityCount[pixel];
+			sf::Uint8* out = &densityPixels[pixel * 4];
+			if (count == 0)
+			{
+				out[0] = out[1] = out[2] = out[3] = 0;
+				continue;
+			}
+
+			out[0] = static_cast<sf::Uint8>(densityColorSum[pixel * 3 + 0] / count);
+			out[1] = static_cast<sf::Uint8>(densityColorSum[pixel * 3 + 1] / count);
+			out[2] = static_cast<sf::Uint8>(densityColorSum[pixel * 3 + 2] / count);
+			out[3] = static_cast<sf::Uint8>(std::min(255.f, count * ballPixelArea * 255.f));
+		}
+	}
+
+	void renderDensity(sf::RenderTarget* window, const CellRange& range, const sf::FloatRect& visible) // one texture upload per frame
+	{
+		const sf::Vector2u pixels = window->getSize();
+		const size_t pixelCount = static_cast<size_t>(pixels.x) * pixels.y;
+		if (densityCount.size() != pixelCount)
+		{
+			densityCount.assign(pixelCount, 0);
+			densityColorSum.assign(pixelCount * 3, 0);
+			densityPixels.assign(pixelCount * 4, 0);
+		}
+		if (densityTexture.getSize() != pixels)
+			densityTexture.create(pixels.x, pixels.y);
+
+		// bands own disjoint rows of the buffers, so they splat in parallel without atomics
+		const size_t bandCount = (pixels.y + densityBandRows - 1) / densityBandRows;
+		auto splatBands = [&](size_t first, size_t last) {
+			for (size_t band = first; band < last; band++)
+			{
+				splatDensityBand(static_cast<unsigned int>(band), range, visible, pixels);
+			}
+		};
+
+		if (threadPool)
+			threadPool->parallelFor(0, bandCount, 1, splatBands);
+		else
+			splatBands(0, bandCount);
+
+		densityTexture.update(densityPixels.data());
+
+		sf::Sprite densitySprite(densityTexture);
+		densitySprite.setPosition(visible.left, visible.top);
+		densitySprite.setScale(visible.width / pixels.x, visible.height / pixels.y);
+		window->draw(densitySprite, regionStates());
+	}
+
+	sf::RenderStates regionStates() const // solver coordinates to world, the only place regionOrigin becomes a float
+	{
+		sf::RenderStates states;
+		states.transform.translate(static_cast<float>(regionOrigin.x), static_cast<float>(regionOrigin.y));
+		return states;
+	}
+
+	void render(sf::RenderTarget* window) // draws the simulation through the target's current view
+	{
+		if (!ballTextureReady)
+			initBallTexture();
+
+		// the view is in world coordinates, culling works in solver coordinates
+		const sf::View& view = window->getView();
+		const sf::Vector2f viewCenter = worldToLocal(sf::Vector2<double>(view.getCenter().x, view.getCenter().y));
+		const sf::FloatRect visible(viewCenter - view.getSize() * 0.5f, view.getSize());
+		const sf::RenderStates states = regionStates();
+
+		if (boundaryMode == BoundaryMode::Periodic)
+			window->draw(backgroundBox, states);
+		else
+			window->draw(backgroundCircle, states);
+
+		for (const StaticSegment& segment : staticSegments)
+		{
+			const sf::Vector2f seg = segment.b - segment.a;
+			sf::RectangleShape wall(sf::Vector2f(std::sqrt(Dot2D(seg, seg)) + segment.thickness, segment.thickness));
+			wall.setOrigin(segment.thickness * 0.5f, segment.thickness * 0.5f);
+			wall.setPosition(segment.a);
+			wall.setRotation(std::atan2(seg.y, seg.x) * 57.2957795f);
+			wall.setFillColor(sf::Color(120, 120, 120, 255));
+			window->draw(wall, states);
+		}
+
+		const CellRange range = visibleCells(visible);
+		const float screenPixels = static_cast<float>(window->getSize().x) * static_cast<float>(window->getSize().y);
+		densityRenderActive = countBallsInCells(range) > lod_balls_per_pixel * screenPixels;
+
+		if (densityRenderActive)
+		{
+			renderDensity(window, range, visible);
+			return;
+		}
 
-		for (VerletObject* obj : verletObjList)
+		buildVisibleBallQuads(range);
+		if (!ballVertices.empty())
 		{
-			obj->render(window);
+			sf::RenderStates ballStates = states;
+			ballStates.texture = &ballTexture;
+			window->draw(ballVertices.data(), ballVertices.size(), sf::Quads, ballStates);
 		}
 	}
 };
\ No newline at end of file
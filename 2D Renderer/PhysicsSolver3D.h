@@ -0,0 +1,156 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <vector>
+
+// SFML includes
+#include <SFML/System.hpp>
+
+// custom includes
+#include "GridCollision.h"
+#include "PhysicsSolver.cpp"
+#include "VerletGrid.cpp"
+#include "VerletObject.cpp"
+#include "util/math.h"
+#include "util/thread_pool.h"
+
+/*
+* 3D ball pile, spheres inside a sphere
+* Runs the uniform 2D substep in three dimensions: gravity, grid build, collision stripes colour 0 -> colour 1, integrate + constrain.
+* The loops are PhysSolver's, instantiated for VerletGrid3D and sf::Vector3f (GridCollision.h): the same stripes, cell walk,
+* gravity and integrate passes, with the contact and boundary kernels PhysSolver's uniform path calls. Balls are
+* VerletBody<sf::Vector3f> and the grid shares its counting sort with the 2D grid. What stays here is the order of the
+* passes, PhysSolver runs them as a task graph with the stages only the 2D scenes have (force fields, segments, materials).
+* Headless only, positions are ball centres since there is no sprite to line up with.
+*/
+
+struct PhysSolver3D
+{
+	typedef VerletBody<sf::Vector3f> Ball;
+
+	// physics data
+	sf::Vector3f gravity = sf::Vector3f(0.f, 1000.f, 0.f); // y points down like the 2D solver
+	std::vector<Ball> balls;
+	VerletGrid3D grid;
+	const float obj_radius = PhysSolver::obj_radius;
+	const float collider_radius = 150.f;
+	const sf::Vector3f collider_pos; // the sphere sits at the origin
+	const float collision_response = 0.75f;
+	int sub_steps = 8;
+
+	// threading, same split as the 2D solver minus the task graph
+	ThreadPool* threadPool = nullptr; // optional, runs single threaded without one
+	const size_t objChunkSize = 1024;
+	const int collisionStripeWidth = 2; // grid x columns per collision stripe, a slab of the y/z plane in 3D
+
+	// every thread counts into its own slot, merged into counters once per update
+	struct CounterSlot
+	{
+		SolverCounters counters;
+		char padding[64];
+	};
+	std::vector<CounterSlot> counterSlots;
+	SolverCounters counters; // last update's work, zero without VERLET_SOLVER_COUNTERS
+
+	PhysSolver3D()
+	{
+		// cells are one ball wide, so a ball can only touch balls in the 27 cells around its own
+		const float extent = collider_radius + obj_radius;
+		grid.configure(collider_pos - sf::Vector3f(extent, extent, extent), sf::Vector3f(extent * 2.f, extent * 2.f, extent * 2.f), obj_radius * 2.f);
+	}
+
+	void addBall(sf::Vector3f pos)
+	{
+		balls.emplace_back(pos);
+	}
+
+	void clearBalls()
+	{
+		balls.clear();
+	}
+
+	template <class Func>
+	void forEachBallChunk(Func&& func) // func(first, last) over every ball, in parallel when there is a pool
+	{
+		ForEachChunk(threadPool, balls.size(), objChunkSize, func);
+	}
+
+	SolverCounters& localCounters()
+	{
+		return counterSlots[threadPool ? threadPool->currentThreadSlot() : 0].counters;
+	}
+
+	void update(float dt) // a fixed sub_steps per frame
+	{
+		const float sub_dt = dt / static_cast<float>(std::max(1, sub_steps));
+
+		const size_t slotCount = threadPool ? threadPool->getThreadCount() + 1 : 1;
+		counterSlots.resize(std::max(counterSlots.size(), slotCount));
+		SOLVER_COUNT(for (CounterSlot& slot : counterSlots) slot.counters = SolverCounters();)
+
+		for (int step = 0; step < sub_steps; step++)
+		{
+			forEachBallChunk([this](size_t first, size_t last) {
+				AccelerateBodies(balls.data(), first, last, gravity);
+			});
+			buildCollisionGrid();
+			applyBallCollisions(0);
+			applyBallCollisions(1);
+			forEachBallChunk([this, sub_dt](size_t first, size_t last) {
+				integrateRange(first, last, sub_dt, localCounters());
+			});
+		}
+
+		counters = SolverCounters();
+		SOLVER_COUNT(for (const CounterSlot& slot : counterSlots) counters.merge(slot.counters);)
+	}
+
+	void buildCollisionGrid()
+	{
+		grid.resetGridContent(balls.size());
+		forEachBallChunk([this](size_t first, size_t last) {
+			for (size_t i = first; i < last; i++)
+			{
+				grid.addObjToGrid(balls[i].curPos, static_cast<uint32_t>(i));
+			}
+		});
+		grid.finishGridContent();
+	}
+
+	void applyBallCollisions(int stripeColour) // every other stripe of x columns, same stripes and cell walk as PhysSolver::applyBallCollisions
+	{
+		const CollisionStripes stripes(grid.width, collisionStripeWidth, stripeColour);
+		stripes.run(threadPool, false, [this, &stripes](size_t first, size_t last) {
+			SolverCounters& stripeCounters = localCounters();
+			stripes.forEachColumn(first, last, [&](int x) {
+				grid.forEachCellInColumn(x, [&](sf::Vector3i cell) {
+					CollideCell<false>(grid, cell, sf::Vector3f(), [&](uint32_t a, uint32_t b, sf::Vector3f, bool) {
+						solveContact(a, b, stripeCounters);
+					});
+				});
+			});
+		});
+	}
+
+	void solveContact(uint32_t aIndex, uint32_t bIndex, [[maybe_unused]] SolverCounters& threadCounters)
+	{
+		SOLVER_COUNT(threadCounters.pairsTested++;)
+		float overlap = 0.f;
+		if (ResolveBallOverlap(balls[aIndex], balls[bIndex], obj_radius * 2.f, collision_response, overlap))
+		{
+			SOLVER_COUNT(threadCounters.contactsResolved++;)
+			SOLVER_COUNT(threadCounters.maxOverlap = std::max(threadCounters.maxOverlap, overlap);)
+		}
+	}
+
+	void integrateRange(size_t first, size_t last, float sub_dt, [[maybe_unused]] SolverCounters& threadCounters) // verlet step and the collider sphere
+	{
+		IntegrateBodies(balls.data(), first, last, sub_dt, [this, &threadCounters](Ball& ball) {
+			if (ConstrainInsideSphere(ball, collider_pos, collider_radius - obj_radius))
+			{
+				SOLVER_COUNT(threadCounters.boundaryHits++;)
+			}
+		});
+	}
+};
@@ -0,0 +1,304 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// SFML includes
+#include <SFML/Graphics.hpp>
+
+// custom includes
+#include "PhysicsSolver.cpp"
+#include "util/thread_pool.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SOFTWARE_RASTERIZER_SSE2
+#endif
+
+/*
+* CPU renderer for machines without a GPU/display, draws the same scene as PhysSolver::render
+* (black clear, white collider or periodic box, grey static segments, anti aliased balls in the solver's ball colour mode)
+* into an RGBA buffer.
+* The frame is split into tiles rendered in parallel, each tile walks only the grid cells under it
+* and blends into a planar float tile, 4 pixels at a time when SSE2 is available.
+*/
+
+class SoftwareRasterizer
+{
+private:
+	static const int TileSize = 64;
+
+	struct Tile // planar colour, one float per channel per pixel
+	{
+		alignas(16) float r[TileSize * TileSize];
+		alignas(16) float g[TileSize * TileSize];
+		alignas(16) float b[TileSize * TileSize];
+	};
+
+	struct FrameMapping // world to pixel transform of the frame being drawn
+	{
+		sf::FloatRect view;
+		float toPixelX = 1.f;
+		float toPixelY = 1.f;
+	};
+
+	unsigned int width = 0;
+	unsigned int height = 0;
+	std::vector<uint32_t> pixels; // RGBA bytes in memory order, ready for sf::Image
+
+	static float coverage(float radius, float dist) // 1 px wide anti aliased edge
+	{
+		return std::max(0.f, std::min(1.f, radius - dist + 0.5f));
+	}
+
+	// blends a disc into one row span of the tile, x0/x1 are tile columns, cx/cy/radius are in tile pixels
+	static void fillDiscSpan(Tile& tile, int row, int x0, int x1, float cx, float cy, float radius, sf::Color color)
+	{
+		const float dy = (row + 0.5f) - cy;
+		const float dySq = dy * dy;
+		const float cr = color.r, cg = color.g, cb = color.b;
+		float* r = tile.r + row * TileSize;
+		float* g = tile.g + row * TileSize;
+		float* b = tile.b + row * TileSize;
+
+		int x = x0;
+#ifdef SOFTWARE_RASTERIZER_SSE2
+		const __m128 vDySq = _mm_set1_ps(dySq);
+		const __m128 vEdge = _mm_set1_ps(radius + 0.5f);
+		const __m128 vZero = _mm_setzero_ps();
+		const __m128 vOne = _mm_set1_ps(1.f);
+		const __m128 vCr = _mm_set1_ps(cr), vCg = _mm_set1_ps(cg), vCb = _mm_set1_ps(cb);
+		const __m128 vStep = _mm_set1_ps(4.f);
+		__m128 vDx = _mm_setr_ps(x + 0.5f - cx, x + 1.5f - cx, x + 2.5f - cx, x + 3.5f - cx);
+
+		for (; x + 4 <= x1; x += 4)
+		{
+			const __m128 dist = _mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(vDx, vDx), vDySq));
+			const __m128 cov = _mm_min_ps(vOne, _mm_max_ps(vZero, _mm_sub_ps(vEdge, dist)));
+
+			const __m128 dr = _mm_loadu_ps(r + x);
+			const __m128 dg = _mm_loadu_ps(g + x);
+			const __m128 db = _mm_loadu_ps(b + x);
+			_mm_storeu_ps(r + x, _mm_add_ps(dr, _mm_mul_ps(_mm_sub_ps(vCr, dr), cov)));
+			_mm_storeu_ps(g + x, _mm_add_ps(dg, _mm_mul_ps(_mm_sub_ps(vCg, dg), cov)));
+			_mm_storeu_ps(b + x, _mm_add_ps(db, _mm_mul_ps(_mm_sub_ps(vCb, db), cov)));
+
+			vDx = _mm_add_ps(vDx, vStep);
+		}
+#endif
+
+		for (; x < x1; x++)
+		{
+			const float dx = (x + 0.5f) - cx;
+			const float cov = coverage(radius, std::sqrt(dx * dx + dySq));
+			r[x] += (cr - r[x]) * cov;
+			g[x] += (cg - g[x]) * cov;
+			b[x] += (cb - b[x]) * cov;
+		}
+	}
+
+	static void fillDisc(Tile& tile, float cx, float cy, float radius, sf::Color color) // cx/cy in tile pixels
+	{
+		const int y0 = std::max(0, static_cast<int>(std::floor(cy - radius - 1.f)));
+		const int y1 = std::min(TileSize, static_cast<int>(std::ceil(cy + radius + 1.f)));
+		for (int y = y0; y < y1; y++)
+		{
+			// only the columns the disc (plus its edge) reaches on this row
+			const float dy = std::max(0.f, std::fabs((y + 0.5f) - cy) - 0.5f);
+			const float reachSq = (radius + 1.f) * (radius + 1.f) - dy * dy;
+			if (reachSq <= 0.f)
+				continue;
+
+			const float reach = std::sqrt(reachSq);
+			const int x0 = std::max(0, static_cast<int>(std::floor(cx - reach)));
+			const int x1 = std::min(TileSize, static_cast<int>(std::ceil(cx + reach)));
+			if (x0 >= x1)
+				continue;
+
+			// pixels whose center is within radius - 0.5 are fully covered, those are a plain fill
+			const float rowDy = (y + 0.5f) - cy;
+			const float innerSq = (radius - 0.5f) * (radius - 0.5f) - rowDy * rowDy;
+			int inner0 = x1, inner1 = x1;
+			if (radius > 0.5f && innerSq > 0.f)
+			{
+				const float inner = std::sqrt(innerSq);
+				inner0 = std::min(x1, std::max(x0, static_cast<int>(std::ceil(cx - inner - 0.5f))));
+				inner1 = std::min(x1, std::max(inner0, static_cast<int>(std::floor(cx + inner - 0.5f)) + 1));
+			}
+
+			if (x0 < inner0)
+				fillDiscSpan(tile, y, x0, inner0, cx, cy, radius, color);
+			if (inner0 < inner1)
+			{
+				std::fill(tile.r + y * TileSize + inner0, tile.r + y * TileSize + inner1, static_cast<float>(color.r));
+				std::fill(tile.g + y * TileSize + inner0, tile.g + y * TileSize + inner1, static_cast<float>(color.g));
+				std::fill(tile.b + y * TileSize + inner0, tile.b + y * TileSize + inner1, static_cast<float>(color.b));
+			}
+			if (inner1 < x1)
+				fillDiscSpan(tile, y, inner1, x1, cx, cy, radius, color);
+		}
+	}
+
+	static void fillCapsule(Tile& tile, sf::Vector2f a, sf::Vector2f b, float radius, sf::Color color) // scalar, there are only a few segments
+	{
+		const int x0 = std::max(0, static_cast<int>(std::floor(std::min(a.x, b.x) - radius - 1.f)));
+		const int x1 = std::min(TileSize, static_cast<int>(std::ceil(std::max(a.x, b.x) + radius + 1.f)));
+		const int y0 = std::max(0, static_cast<int>(std::floor(std::min(a.y, b.y) - radius - 1.f)));
+		const int y1 = std::min(TileSize, static_cast<int>(std::ceil(std::max(a.y, b.y) + radius + 1.f)));
+
+		for (int y = y0; y < y1; y++)
+		{
+			for (int x = x0; x < x1; x++)
+			{
+				const sf::Vector2f p(x + 0.5f, y + 0.5f);
+				const float cov = coverage(radius, EuclideanDist2D(p, ClosestPointOnSegment2D(p, a, b)));
+				const int i = y * TileSize + x;
+				tile.r[i] += (color.r - tile.r[i]) * cov;
+				tile.g[i] += (color.g - tile.g[i]) * cov;
+				tile.b[i] += (color.b - tile.b[i]) * cov;
+			}
+		}
+	}
+
+	static void fillRect(Tile& tile, sf::Vector2f low, sf::Vector2f high, sf::Color color) // low/high in tile pixels, edge pixels get their covered share
+	{
+		const int x0 = std::max(0, static_cast<int>(std::floor(low.x)));
+		const int x1 = std::min(TileSize, static_cast<int>(std::ceil(high.x)));
+		const int y0 = std::max(0, static_cast<int>(std::floor(low.y)));
+		const int y1 = std::min(TileSize, static_cast<int>(std::ceil(high.y)));
+
+		for (int y = y0; y < y1; y++)
+		{
+			const float covY = std::min(high.y, y + 1.f) - std::max(low.y, static_cast<float>(y));
+			for (int x = x0; x < x1; x++)
+			{
+				const float cov = covY * (std::min(high.x, x + 1.f) - std::max(low.x, static_cast<float>(x)));
+				const int i = y * TileSize + x;
+				tile.r[i] += (color.r - tile.r[i]) * cov;
+				tile.g[i] += (color.g - tile.g[i]) * cov;
+				tile.b[i] += (color.b - tile.b[i]) * cov;
+			}
+		}
+	}
+
+	void renderTile(const PhysSolver& solver, const FrameMapping& mapping, int tileX, int tileY)
+	{
+		Tile tile;
+		std::fill(tile.r, tile.r + TileSize * TileSize, 0.f);
+		std::fill(tile.g, tile.g + TileSize * TileSize, 0.f);
+		std::fill(tile.b, tile.b + TileSize * TileSize, 0.f);
+
+		const int pixelX = tileX * TileSize;
+		const int pixelY = tileY * TileSize;
+		auto toTile = [&](sf::Vector2f world) {
+			return sf::Vector2f((world.x - mapping.view.left) * mapping.toPixelX - pixelX, (world.y - mapping.view.top) * mapping.toPixelY - pixelY);
+		};
+
+		// collider, or the box in periodic mode like PhysSolver::render
+		if (solver.boundaryMode == BoundaryMode::Periodic)
+		{
+			const sf::Vector2f boxLow = solver.backgroundBox.getPosition();
+			fillRect(tile, toTile(boxLow), toTile(boxLow + solver.backgroundBox.getSize()), sf::Color::White);
+		}
+		else
+		{
+			const sf::Vector2f colliderCenter = toTile(solver.collider_pos);
+			fillDisc(tile, colliderCenter.x, colliderCenter.y, solver.collider_radius * mapping.toPixelX, sf::Color::White);
+		}
+
+		// static segments
+		for (const StaticSegment& segment : solver.staticSegments)
+		{
+			fillCapsule(tile, toTile(segment.a), toTile(segment.b), segment.thickness * 0.5f * mapping.toPixelX, sf::Color(120, 120, 120, 255));
+		}
+
+		// balls, from the grid cells under the tile (positions are the top left of a ball)
+		const VerletGrid& grid = solver.verletScreenGrid;
+		const float margin = solver.obj_radius * 2.f + grid.cellSize;
+		const float worldLeft = mapping.view.left + pixelX / mapping.toPixelX;
+		const float worldTop = mapping.view.top + pixelY / mapping.toPixelY;
+		const int cellX0 = grid.cellX(worldLeft - margin);
+		const int cellX1 = grid.cellX(worldLeft + TileSize / mapping.toPixelX + margin);
+		const int cellY0 = grid.cellY(worldTop - margin);
+		const int cellY1 = grid.cellY(worldTop + TileSize / mapping.toPixelY + margin);
+
+		solver.withBallColors([&](auto colorOf) { // the colour mode PhysSolver::render shades the quads with
+			for (int y = cellY0; y <= cellY1; y++)
+			{
+				for (int x = cellX0; x <= cellX1; x++)
+				{
+					for (uint32_t objIndex : grid.getCell(x, y))
+					{
+						const VerletObject& obj = solver.verletObjList[objIndex];
+						const sf::Vector2f center = toTile(obj.curPos + sf::Vector2f(obj.radius, obj.radius));
+						fillDisc(tile, center.x, center.y, obj.radius * mapping.toPixelX, colorOf(objIndex));
+					}
+				}
+			}
+		});
+
+		// resolve into the frame
+		const int rows = std::min(TileSize, static_cast<int>(this->height) - pixelY);
+		const int cols = std::min(TileSize, static_cast<int>(this->width) - pixelX);
+		for (int y = 0; y < rows; y++)
+		{
+			uint8_t* out = reinterpret_cast<uint8_t*>(&this->pixels[static_cast<size_t>(pixelY + y) * this->width + pixelX]);
+			for (int x = 0; x < cols; x++)
+			{
+				const int i = y * TileSize + x;
+				out[x * 4 + 0] = static_cast<uint8_t>(tile.r[i] + 0.5f);
+				out[x * 4 + 1] = static_cast<uint8_t>(tile.g[i] + 0.5f);
+				out[x * 4 + 2] = static_cast<uint8_t>(tile.b[i] + 0.5f);
+				out[x * 4 + 3] = 255;
+			}
+		}
+	}
+
+public:
+	void render(PhysSolver& solver, const sf::FloatRect& view, unsigned int frameWidth, unsigned int frameHeight, ThreadPool* pool = nullptr) // draws the world rect view into a frameWidth x frameHeight frame
+	{
+		this->width = frameWidth;
+		this->height = frameHeight;
+		this->pixels.resize(static_cast<size_t>(frameWidth) * frameHeight);
+
+		solver.visibleCells(view); // makes sure the grid matches the current balls
+
+		FrameMapping mapping;
+		mapping.view = view;
+		mapping.toPixelX = frameWidth / view.width;
+		mapping.toPixelY = frameHeight / view.height;
+
+		const int tilesX = (static_cast<int>(frameWidth) + TileSize - 1) / TileSize;
+		const int tilesY = (static_cast<int>(frameHeight) + TileSize - 1) / TileSize;
+		auto renderTiles = [&](size_t first, size_t last) {
+			for (size_t t = first; t < last; t++)
+			{
+				this->renderTile(solver, mapping, static_cast<int>(t) % tilesX, static_cast<int>(t) / tilesX);
+			}
+		};
+
+		const size_t tileCount = static_cast<size_t>(tilesX) * tilesY;
+		if (pool)
+			pool->parallelFor(0, tileCount, 1, renderTiles);
+		else
+			renderTiles(0, tileCount);
+	}
+
+	const uint8_t* getPixels() const // RGBA, width * height * 4 bytes
+	{
+		return reinterpret_cast<const uint8_t*>(this->pixels.data());
+	}
+
+	unsigned int getWidth() const { return this->width; }
+	unsigned int getHeight() const { return this->height; }
+
+	bool saveToFile(const std::string& path) const // any format sf::Image supports, picked by extension
+	{
+		sf::Image image;
+		image.create(this->width, this->height, this->getPixels());
+		return image.saveToFile(path);
+	}
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// SFML includes
+#include <SFML/Graphics.hpp>
+
+// custom includes
+#include "PhysicsSolver.cpp"
+#include "util/math.h"
+
+/*
+* Spatial queries on the solver's collision grid
+* - only the cells that can hold an answer are visited, so a query costs in proportion to the balls near it, not the ball count
+* - the grid is the one the last substep built, a ball may have moved up to a cell since, so every search is widened by a
+*   cell and the final test is always against the current positions. Call PhysSolver::refreshSpatialIndex first if balls
+*   were added or removed since the last update.
+* - everything here only reads the solver and writes to the caller's output, so any number of threads can query at once
+*   as long as nothing updates or edits the solver meanwhile
+* - positions are ball centres (curPos + radius), results are ball indices into verletObjList
+*/
+
+struct BallRayHit
+{
+	uint32_t objIndex = 0;
+	float distance = 0.f; // along the ray from its origin to where it enters the ball
+};
+
+namespace SpatialQueries
+{
+	struct CellBounds // inclusive
+	{
+		int x0, y0, x1, y1;
+	};
+
+	inline sf::Vector2f ballCenter(const PhysSolver& solver, uint32_t objIndex)
+	{
+		return solver.verletObjList[objIndex].curPos + sf::Vector2f(solver.obj_radius, solver.obj_radius);
+	}
+
+	inline CellBounds cellsAround(const PhysSolver& solver, sf::Vector2f low, sf::Vector2f high) // cells whose balls can have a centre in [low, high]
+	{
+		// cells hold balls by their top left, one radius up and left of the centre, plus the cell a ball may have moved since the build
+		const VerletGrid& grid = solver.verletScreenGrid;
+		const float margin = grid.cellSize;
+		const sf::Vector2f topLeftOffset(solver.obj_radius, solver.obj_radius);
+		CellBounds bounds;
+		bounds.x0 = grid.cellX(low.x - topLeftOffset.x - margin);
+		bounds.y0 = grid.cellY(low.y - topLeftOffset.y - margin);
+		bounds.x1 = grid.cellX(high.x - topLeftOffset.x + margin);
+		bounds.y1 = grid.cellY(high.y - topLeftOffset.y + margin);
+		return bounds;
+	}
+
+	template <class Func>
+	void forEachBallInCells(const PhysSolver& solver, const CellBounds& bounds, Func&& func) // func(objIndex) for every ball binned in the cells
+	{
+		const VerletGrid& grid = solver.verletScreenGrid;
+		for (int y = bounds.y0; y <= bounds.y1; y++)
+		{
+			// a row of cells is contiguous in cellObjects
+			const GridContent row = grid.getCellContent(static_cast<size_t>(y) * grid.width + bounds.x0);
+			const uint32_t* rowEnd = grid.cellObjects.data() + grid.cellStart[static_cast<size_t>(y) * grid.width + bounds.x1 + 1];
+			for (const uint32_t* obj = row.begin(); obj != rowEnd; obj++)
+			{
+				func(*obj);
+			}
+		}
+	}
+}
+
+// balls overlapping the circle, appended to out, returns how many were found
+inline size_t QueryBallsInCircle(const PhysSolver& solver, sf::Vector2f center, float radius, std::vector<uint32_t>& out)
+{
+	const float reach = radius + solver.obj_radius;
+	const SpatialQueries::CellBounds bounds = SpatialQueries::cellsAround(solver, center - sf::Vector2f(reach, reach), center + sf::Vector2f(reach, reach));
+
+	const size_t before = out.size();
+	SpatialQueries::forEachBallInCells(solver, bounds, [&](uint32_t objIndex) {
+		if (EuclideanDistSq(SpatialQueries::ballCenter(solver, objIndex), center) <= reach * reach)
+			out.push_back(objIndex);
+	});
+	return out.size() - before;
+}
+
+// balls overlapping the rect, appended to out, returns how many were found
+inline size_t QueryBallsInRect(const PhysSolver& solver, const sf::FloatRect& rect, std::vector<uint32_t>& out)
+{
+	const sf::Vector2f low(rect.left, rect.top);
+	const sf::Vector2f high(rect.left + rect.width, rect.top + rect.height);
+	const float r = solver.obj_radius;
+	const SpatialQueries::CellBounds bounds = SpatialQueries::cellsAround(solver, low - sf::Vector2f(r, r), high + sf::Vector2f(r, r));
+
+	const size_t before = out.size();
+	SpatialQueries::forEachBallInCells(solver, bounds, [&](uint32_t objIndex) {
+		const sf::Vector2f c = SpatialQueries::ballCenter(solver, objIndex);
+		const sf::Vector2f closest(std::max(low.x, std::min(high.x, c.x)), std::max(low.y, std::min(high.y, c.y)));
+		if (EuclideanDistSq(c, closest) <= r * r)
+			out.push_back(objIndex);
+	});
+	return out.size() - before;
+}
+
+// the k balls whose centres are closest to point, nearest first, out is overwritten. Searches outwards ring by ring
+// and stops once no unvisited cell can hold anything closer than the k-th ball found.
+inline size_t QueryNearestBalls(const PhysSolver& solver, sf::Vector2f point, size_t k, std::vector<uint32_t>& out)
+{
+	out.clear();
+	if (k == 0 || solver.verletObjList.empty())
+		return 0;
+
+	const VerletGrid& grid = solver.verletScreenGrid;
+	const sf::Vector2f binPoint = point - sf::Vector2f(solver.obj_radius, solver.obj_radius); // the point in top left terms, how balls are binned
+	const int cx = grid.cellX(binPoint.x);
+	const int cy = grid.cellY(binPoint.y);
+	const int maxRing = std::max(std::max(cx, grid.width - 1 - cx), std::max(cy, grid.height - 1 - cy));
+
+	// out is kept sorted by distance, k is expected to be small so insertion beats a heap
+	float kthDistSq = std::numeric_limits<float>::infinity();
+	auto consider = [&](uint32_t objIndex) {
+		const float distSq = EuclideanDistSq(SpatialQueries::ballCenter(solver, objIndex), point);
+		if (out.size() == k && distSq >= kthDistSq)
+			return;
+
+		size_t at = out.size() < k ? out.size() : k - 1;
+		if (out.size() < k)
+			out.push_back(objIndex);
+		while (at > 0 && EuclideanDistSq(SpatialQueries::ballCenter(solver, out[at - 1]), point) > distSq)
+		{
+			out[at] = out[at - 1];
+			at--;
+		}
+		out[at] = objIndex;
+
+		if (out.size() == k)
+			kthDistSq = EuclideanDistSq(SpatialQueries::ballCenter(solver, out[k - 1]), point);
+	};
+
+	for (int ring = 0; ring <= maxRing; ring++)
+	{
+		// a ball binned ring cells away has its centre at least (ring - 1) cells from the point, less a cell for movement
+		const float reach = std::max(0, ring - 2) * grid.cellSize;
+		if (out.size() == k && reach * reach > kthDistSq)
+			break;
+
+		for (int y = cy - ring; y <= cy + ring; y++)
+		{
+			if (y < 0 || y >= grid.height)
+				continue;
+
+			const bool edgeRow = y == cy - ring || y == cy + ring;
+			for (int x = cx - ring; x <= cx + ring; x += edgeRow || ring == 0 ? 1 : 2 * ring) // whole top and bottom rows, just the ends of the others
+			{
+				if (x < 0 || x >= grid.width)
+					continue;
+
+				for (uint32_t objIndex : grid.getCell(x, y))
+				{
+					consider(objIndex);
+				}
+			}
+		}
+	}
+	return out.size();
+}
+
+// the first ball the ray from origin along direction (any length) hits within maxDistance, false if none.
+// Walks the grid cells the ray crosses in order and stops once a hit is closer than the cells still ahead.
+inline bool RaycastBalls(const PhysSolver& solver, sf::Vector2f origin, sf::Vector2f direction, float maxDistance, BallRayHit& hit)
+{
+	const float dirLen = std::sqrt(LengthSq(direction));
+	if (dirLen <= 0.f || maxDistance <= 0.f || solver.verletObjList.empty())
+		return false;
+
+	const sf::Vector2f dir = direction / dirLen;
+	const sf::Vector2f end = origin + dir * maxDistance;
+	const VerletGrid& grid = solver.verletScreenGrid;
+	const float r = solver.obj_radius;
+
+	float best = std::numeric_limits<float>::infinity();
+	auto testCell = [&](int x, int y) {
+		if (x < 0 || y < 0 || x >= grid.width || y >= grid.height)
+			return;
+
+		for (uint32_t objIndex : grid.getCell(x, y))
+		{
+			const sf::Vector2f c = SpatialQueries::ballCenter(solver, objIndex);
+			float distance;
+			if (EuclideanDistSq(origin, c) <= r * r) // starts inside the ball
+				distance = 0.f;
+			else
+			{
+				const float t = RayCircleHit2D(origin, end, c, r);
+				if (t < 0.f)
+					continue;
+				distance = t * maxDistance;
+			}
+
+			if (distance < best || (distance == best && objIndex < hit.objIndex))
+			{
+				best = distance;
+				hit.objIndex = objIndex;
+				hit.distance = distance;
+			}
+		}
+	};
+
+	// Amanatides & Woo grid walk along the top left shifted ray, each visited cell is tested with its 3x3 block so balls that
+	// stick out of their cell or moved since the build are still seen
+	const sf::Vector2f start = origin - sf::Vector2f(r, r);
+	int x = static_cast<int>(std::floor((start.x - grid.origin.x) / grid.cellSize)); // not clamped, the ray may start off the grid
+	int y = static_cast<int>(std::floor((start.y - grid.origin.y) / grid.cellSize));
+	const int stepX = dir.x > 0.f ? 1 : -1;
+	const int stepY = dir.y > 0.f ? 1 : -1;
+	const float inf = std::numeric_limits<float>::infinity();
+	const float deltaX = dir.x != 0.f ? grid.cellSize / std::abs(dir.x) : inf;
+	const float deltaY = dir.y != 0.f ? grid.cellSize / std::abs(dir.y) : inf;
+	const float cellLeft = grid.origin.x + x * grid.cellSize;
+	const float cellTop = grid.origin.y + y * grid.cellSize;
+	float nextX = dir.x != 0.f ? (stepX > 0 ? cellLeft + grid.cellSize - start.x : start.x - cellLeft) / std::abs(dir.x) : inf;
+	float nextY = dir.y != 0.f ? (stepY > 0 ? cellTop + grid.cellSize - start.y : start.y - cellTop) / std::abs(dir.y) : inf;
+	float travelled = 0.f;
+
+	while (true)
+	{
+		for (int ny = y - 1; ny <= y + 1; ny++)
+		{
+			for (int nx = x - 1; nx <= x + 1; nx++)
+			{
+				testCell(nx, ny);
+			}
+		}
+
+		// balls in cells further along are at least this far, minus the block and movement slack
+		if (best <= travelled - 2.f * grid.cellSize || travelled > maxDistance + 2.f * grid.cellSize)
+			break;
+
+		if (nextX < nextY)
+		{
+			x += stepX;
+			travelled = nextX;
+			nextX += deltaX;
+		}
+		else
+		{
+			y += stepY;
+			travelled = nextY;
+			nextY += deltaY;
+		}
+
+		// off the grid and its border block, heading further out
+		if ((x < -1 && stepX < 0) || (x > grid.width && stepX > 0) || (y < -1 && stepY < 0) || (y > grid.height && stepY > 0))
+			break;
+	}
+
+	return best <= maxDistance;
+}
@@ -4,32 +4,282 @@
 #include <SFML/Graphics.hpp>
 
 // normal includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
 #include <vector>
 
 // custom includes
 #include "VerletObject.cpp"
 
-struct GridContent
+struct GridContent // the balls sitting in one cell, usable in a range for
 {
+	const uint32_t* first = nullptr;
+	const uint32_t* last = nullptr;
 
+	const uint32_t* begin() const { return first; }
+	const uint32_t* end() const { return last; }
+	size_t size() const { return static_cast<size_t>(last - first); }
 };
 
-struct VerletGrid {
+struct GridCells // cell contents, shared by the 2D and 3D grids, built with a counting sort so a rebuild never allocates once sized
+{
+	std::vector<uint32_t> cellStart; // cellStart[c] .. cellStart[c + 1] indexes into cellObjects
+	std::vector<uint32_t> cellObjects; // object indices ordered by cell
+	std::vector<uint32_t> objectCell; // cell of every object for the current build
+
+	GridContent getCellContent(size_t c) const
+	{
+		GridContent content;
+		content.first = cellObjects.data() + cellStart[c];
+		content.last = cellObjects.data() + cellStart[c + 1];
+		return content;
+	}
 
+	void resetGridContent(size_t objCount) // sizes the per object arrays, call before assigning cells
+	{
+		objectCell.resize(objCount);
+		cellObjects.resize(objCount);
+	}
+
+	void finishGridContent() // counting sort of the assigned cells into cellObjects
+	{
+		std::fill(cellStart.begin(), cellStart.end(), 0);
+		for (uint32_t cell : objectCell)
+		{
+			cellStart[cell]++;
+		}
+
+		for (size_t c = 1; c < cellStart.size(); c++)
+		{
+			cellStart[c] += cellStart[c - 1];
+		}
+
+		// cellStart now holds the end of every cell, walk backwards filling each cell from its end
+		// which leaves cellStart at the cell starts and keeps objects in index order inside a cell
+		for (size_t i = objectCell.size(); i--;)
+		{
+			cellObjects[--cellStart[objectCell[i]]] = static_cast<uint32_t>(i);
+		}
+	}
+};
+
+inline int GridAxisCell(float pos, float origin, float cellSize, int cells) // clamps, so anything outside goes to the border cells
+{
+	return std::min(cells - 1, std::max(0, static_cast<int>((pos - origin) / cellSize)));
+}
+
+struct VerletGrid : GridCells {
+	typedef sf::Vector2f Vec;
+	typedef sf::Vector2i Coord; // cell coordinates
+
+	// a cell collides with the half of its neighbours that come after it, the other half visit it. All of them are in the
+	// same or the next column, which is what lets GridCollision.h's stripes of columns run in parallel.
+	static const int halfNeighbourCount = 4;
+
+	// grid layout
+	sf::Vector2f origin; // world position of the top left of cell (0, 0)
+	float cellSize = 1.f;
+	int width = 0; // cells
+	int height = 0;
 
 	VerletGrid() // constructor
 	{
 
 	}
 
-	void resetGridContent()
+	void configure(sf::Vector2f gridOrigin, sf::Vector2f size, float gridCellSize) // sets the area covered, anything outside goes to the border cells
+	{
+		origin = gridOrigin;
+		cellSize = gridCellSize;
+		width = std::max(1, static_cast<int>(std::ceil(size.x / cellSize)));
+		height = std::max(1, static_cast<int>(std::ceil(size.y / cellSize)));
+
+		cellStart.assign(static_cast<size_t>(width) * height + 1, 0);
+	}
+
+	int cellX(float x) const
+	{
+		return GridAxisCell(x, origin.x, cellSize, width);
+	}
+
+	int cellY(float y) const
+	{
+		return GridAxisCell(y, origin.y, cellSize, height);
+	}
+
+	uint32_t cellIndex(sf::Vector2f pos) const
+	{
+		return static_cast<uint32_t>(cellY(pos.y) * width + cellX(pos.x));
+	}
+
+	GridContent getCell(int x, int y) const
+	{
+		return getCellContent(static_cast<size_t>(y) * width + x);
+	}
+
+	GridContent getCell(Coord c) const
+	{
+		return getCell(c.x, c.y);
+	}
+
+	static Coord halfNeighbour(int i) // the right and lower neighbours
+	{
+		static const int offsets[halfNeighbourCount][2] = { {1, -1}, {1, 0}, {1, 1}, {0, 1} };
+		return Coord(offsets[i][0], offsets[i][1]);
+	}
+
+	bool contains(Coord c) const
+	{
+		return c.x >= 0 && c.y >= 0 && c.x < width && c.y < height;
+	}
+
+	Coord wrap(Coord c, Vec period, Vec& shift) const // a cell past an edge to the one it stands for across the opposite edge, shift is where that cell's content appears from c
+	{
+		if (c.x < 0)
+		{
+			c.x += width;
+			shift.x = -period.x;
+		}
+		else if (c.x >= width)
+		{
+			c.x -= width;
+			shift.x = period.x;
+		}
+
+		if (c.y < 0)
+		{
+			c.y += height;
+			shift.y = -period.y;
+		}
+		else if (c.y >= height)
+		{
+			c.y -= height;
+			shift.y = period.y;
+		}
+		return c;
+	}
+
+	template <class Func>
+	void forEachCellInColumn(int x, Func&& func) const // func(Coord) top to bottom
 	{
+		for (int y = 0; y < height; y++)
+		{
+			func(Coord(x, y));
+		}
+	}
 
+	void addVerletObjToGrid(const VerletObject& object, uint32_t objIndex) // safe to call in parallel for different indices
+	{
+		objectCell[objIndex] = cellIndex(object.curPos);
 	}
 
-	void addVerletObjToGrid(VerletObject* object)
+	void addObjToGrid(sf::Vector2f pos, uint32_t objIndex) // for callers that keep positions outside VerletObject, safe in parallel like the above
 	{
+		objectCell[objIndex] = cellIndex(pos);
+	}
 
+	void addObjToCell(uint32_t objIndex, int x, int y) // for callers that bin positions themselves, x and y must be inside the grid
+	{
+		objectCell[objIndex] = static_cast<uint32_t>(y * width + x);
 	}
+};
+
+struct VerletGrid3D : GridCells {
+	typedef sf::Vector3f Vec;
+	typedef sf::Vector3i Coord;
 
-};
\ No newline at end of file
+	// the 13 of the 26 neighbours whose first non zero offset (x, then y, then z) is positive, like the 2D grid's they only
+	// reach the next x column
+	static const int halfNeighbourCount = 13;
+
+	// grid layout, cells are stored x fastest then y then z
+	sf::Vector3f origin; // position of the low corner of cell (0, 0, 0)
+	float cellSize = 1.f;
+	int width = 0; // cells
+	int height = 0;
+	int depth = 0;
+
+	void configure(sf::Vector3f gridOrigin, sf::Vector3f size, float gridCellSize)
+	{
+		origin = gridOrigin;
+		cellSize = gridCellSize;
+		width = std::max(1, static_cast<int>(std::ceil(size.x / cellSize)));
+		height = std::max(1, static_cast<int>(std::ceil(size.y / cellSize)));
+		depth = std::max(1, static_cast<int>(std::ceil(size.z / cellSize)));
+
+		cellStart.assign(static_cast<size_t>(width) * height * depth + 1, 0);
+	}
+
+	uint32_t cellIndex(sf::Vector3f pos) const
+	{
+		const int x = GridAxisCell(pos.x, origin.x, cellSize, width);
+		const int y = GridAxisCell(pos.y, origin.y, cellSize, height);
+		const int z = GridAxisCell(pos.z, origin.z, cellSize, depth);
+		return static_cast<uint32_t>((static_cast<size_t>(z) * height + y) * width + x);
+	}
+
+	GridContent getCell(int x, int y, int z) const
+	{
+		return getCellContent((static_cast<size_t>(z) * height + y) * width + x);
+	}
+
+	GridContent getCell(Coord c) const
+	{
+		return getCell(c.x, c.y, c.z);
+	}
+
+	static Coord halfNeighbour(int i)
+	{
+		static const int offsets[halfNeighbourCount][3] = {
+			{1, -1, -1}, {1, -1, 0}, {1, -1, 1}, {1, 0, -1}, {1, 0, 0}, {1, 0, 1}, {1, 1, -1}, {1, 1, 0}, {1, 1, 1},
+			{0, 1, -1}, {0, 1, 0}, {0, 1, 1},
+			{0, 0, 1}
+		};
+		return Coord(offsets[i][0], offsets[i][1], offsets[i][2]);
+	}
+
+	bool contains(Coord c) const
+	{
+		return c.x >= 0 && c.y >= 0 && c.z >= 0 && c.x < width && c.y < height && c.z < depth;
+	}
+
+	Coord wrap(Coord c, Vec period, Vec& shift) const // like VerletGrid::wrap, one more axis
+	{
+		const int cells[3] = { width, height, depth };
+		int* coord[3] = { &c.x, &c.y, &c.z };
+		float* offset[3] = { &shift.x, &shift.y, &shift.z };
+		const float size[3] = { period.x, period.y, period.z };
+		for (int axis = 0; axis < 3; axis++)
+		{
+			if (*coord[axis] < 0)
+			{
+				*coord[axis] += cells[axis];
+				*offset[axis] = -size[axis];
+			}
+			else if (*coord[axis] >= cells[axis])
+			{
+				*coord[axis] -= cells[axis];
+				*offset[axis] = size[axis];
+			}
+		}
+		return c;
+	}
+
+	template <class Func>
+	void forEachCellInColumn(int x, Func&& func) const // func(Coord) over the y/z plane at x
+	{
+		for (int z = 0; z < depth; z++)
+		{
+			for (int y = 0; y < height; y++)
+			{
+				func(Coord(x, y, z));
+			}
+		}
+	}
+
+	void addObjToGrid(sf::Vector3f pos, uint32_t objIndex) // safe to call in parallel for different indices
+	{
+		objectCell[objIndex] = cellIndex(pos);
+	}
+};
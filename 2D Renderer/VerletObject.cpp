@@ -3,53 +3,99 @@
 // SFML includes
 #include <SFML/Graphics.hpp>
 
+#include <cmath>
 #include <iostream>
 
-using namespace std;
+// custom includes
+#include "util/math.h"
 
-struct VerletObject
-{
-	int objID;
+using namespace std;
 
-	sf::Vector2f curPos;
-	sf::Vector2f lastPos;
-	sf::Vector2f acceleration;
+/*
+* Verlet state and kernels shared by the 2D and 3D solvers, Vec is sf::Vector2f or sf::Vector3f
+*/
 
-	sf::CircleShape shape;
+template <class Vec>
+struct VerletBody
+{
+	Vec curPos;
+	Vec lastPos;
+	Vec acceleration;
 
-	VerletObject(sf::Vector2f startPos, float rad, int id)
+	explicit VerletBody(Vec startPos) : curPos(startPos), lastPos(startPos), acceleration()
 	{
-		objID = id;
-		shape.setFillColor(sf::Color(50,50,50,255));
-		shape.setRadius(rad);
 
-		shape.setPosition(startPos);
-		curPos = startPos;
-		lastPos = startPos;
-		acceleration = sf::Vector2f(0.f, 0.f);
 	}
 
-	void accelerate(sf::Vector2f acc)
+	void accelerate(Vec acc)
 	{
 		this->acceleration += acc;
 	}
 	
 	void updatePosition(float dt)
 	{
-		const sf::Vector2f velocity = curPos - lastPos;
+		const Vec velocity = curPos - lastPos;
 
 		lastPos = curPos;
 
 		curPos = curPos + velocity + acceleration * (dt * dt);
 
 		acceleration = {};
+	}
+};
 
-		shape.setPosition(curPos);
+// pushes two equal balls apart by response * overlap, half each, v is a.curPos minus wherever b is seen from a.
+// Returns false if they don't touch
+template <class Vec>
+inline bool ResolveBallOverlapAlong(VerletBody<Vec>& a, VerletBody<Vec>& b, Vec v, float minDist, float response, float& overlap)
+{
+	const float distSq = LengthSq(v);
+	if (distSq >= minDist * minDist || distSq <= 1e-8f)
+		return false;
+
+	const float dist = std::sqrt(distSq);
+	const Vec n = v / dist;
+	const float correction = response * (minDist - dist);
+	a.curPos += n * (0.5f * correction);
+	b.curPos -= n * (0.5f * correction);
+	overlap = minDist - dist;
+	return true;
+}
+
+template <class Vec>
+inline bool ResolveBallOverlap(VerletBody<Vec>& a, VerletBody<Vec>& b, float minDist, float response, float& overlap)
+{
+	return ResolveBallOverlapAlong(a, b, a.curPos - b.curPos, minDist, response, overlap);
+}
+
+// keeps a ball within limit of center (the collider circle or sphere shrunk by the ball radius), returns true if it had to move
+template <class Vec>
+inline bool ConstrainInsideSphere(VerletBody<Vec>& body, Vec center, float limit)
+{
+	const Vec v = center - body.curPos;
+	const float dist = std::sqrt(LengthSq(v));
+	if (dist > limit)
+	{
+		const Vec n = v / dist;
+		body.curPos = center - n * limit;
+		return true;
 	}
+	return false;
+}
+
+struct VerletObject : VerletBody<sf::Vector2f>
+{
+	int objID;
 
-	void render(sf::RenderWindow* window)
+	// drawn as a textured quad by the solver, see PhysSolver::render
+	float radius;
+	sf::Color color;
+
+	VerletObject(sf::Vector2f startPos, float rad, int id) : VerletBody<sf::Vector2f>(startPos)
 	{
-		window->draw(shape);
+		objID = id;
+		color = sf::Color(50,50,50,255);
+		radius = rad;
 	}
 
 	// signs
@@ -0,0 +1,150 @@
+#pragma once
+
+// std includes
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// SFML includes
+#include <SFML/Graphics.hpp>
+
+// custom includes
+#include "PhysicsSolver.cpp"
+#include "util/thread_pool.h"
+
+/*
+* Runs many independent PhysSolver worlds across a thread pool, one world per task.
+* Used for parameter sweeps, every world is built, simulated, measured and freed inside its own task
+* so memory stays bounded to the worlds currently in flight.
+*/
+
+struct WorldResult
+{
+	size_t worldIndex = 0;
+	size_t ballCount = 0;
+	sf::Vector2f centerOfMass;
+	float kineticEnergy = 0.f; // sum of 0.5 * v^2, every ball has unit mass
+	float maxSpeed = 0.f;
+	double wallSeconds = 0.0; // time spent simulating this world
+	SolverCounters counters; // summed over every frame, zero without solver counters
+};
+
+struct WorldBatchSummary
+{
+	size_t worldCount = 0;
+	size_t totalBalls = 0;
+	size_t totalWorldFrames = 0;
+	float meanKineticEnergy = 0.f;
+	float maxSpeed = 0.f;
+	double wallSeconds = 0.0; // time for the whole batch
+	double worldFramesPerSecond = 0.0; // throughput over all worlds
+	SolverCounters counters; // summed over every world
+};
+
+class WorldBatch
+{
+private:
+	ThreadPool pool;
+	std::vector<WorldResult> results;
+	double lastRunSeconds = 0.0;
+	size_t lastFrameCount = 0;
+
+	static WorldResult measureWorld(const PhysSolver& world, size_t worldIndex)
+	{
+		WorldResult result;
+		result.worldIndex = worldIndex;
+		result.ballCount = world.verletObjList.size();
+
+		const float sub_dt = world.currentSubDt > 0.f ? world.currentSubDt : 1.f;
+		for (const VerletObject& obj : world.verletObjList)
+		{
+			const sf::Vector2f velocity = (obj.curPos - obj.lastPos) / sub_dt;
+			const float speedSq = velocity.x * velocity.x + velocity.y * velocity.y;
+
+			result.centerOfMass += obj.curPos;
+			result.kineticEnergy += 0.5f * speedSq;
+			result.maxSpeed = std::max(result.maxSpeed, std::sqrt(speedSq));
+		}
+
+		if (result.ballCount > 0)
+			result.centerOfMass /= static_cast<float>(result.ballCount);
+
+		return result;
+	}
+
+public:
+	// called inside the world's task to fill it with balls / tweak parameters, worldIndex identifies the sweep point
+	std::function<void(PhysSolver& world, size_t worldIndex)> setupWorld;
+
+	explicit WorldBatch(size_t threadCount = ThreadPool::defaultThreadCount()) : pool(threadCount)
+	{
+
+	}
+
+	void run(size_t worldCount, size_t frameCount, float dt) // simulates every world for frameCount frames, blocks until done
+	{
+		this->results.assign(worldCount, WorldResult());
+		this->lastFrameCount = frameCount;
+
+		const auto batchStart = std::chrono::steady_clock::now();
+
+		for (size_t worldIndex = 0; worldIndex < worldCount; worldIndex++)
+		{
+			this->pool.submit([this, worldIndex, frameCount, dt]() {
+				const auto worldStart = std::chrono::steady_clock::now();
+
+				std::unique_ptr<PhysSolver> world(new PhysSolver()); // freed when the task ends, even if setupWorld throws
+				if (this->setupWorld)
+					this->setupWorld(*world, worldIndex);
+
+				SolverCounters counters;
+				for (size_t frame = 0; frame < frameCount; frame++)
+				{
+					world->update(dt);
+					counters.merge(world->stats.counters);
+				}
+
+				WorldResult result = measureWorld(*world, worldIndex);
+				result.counters = counters;
+				world.reset();
+
+				result.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - worldStart).count();
+				this->results[worldIndex] = result; // every task owns its own slot
+			});
+		}
+
+		this->pool.waitIdle();
+		this->lastRunSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStart).count();
+	}
+
+	const std::vector<WorldResult>& getResults() const
+	{
+		return this->results;
+	}
+
+	WorldBatchSummary summarize() const // aggregates the per world results of the last run
+	{
+		WorldBatchSummary summary;
+		summary.worldCount = this->results.size();
+		summary.totalWorldFrames = this->results.size() * this->lastFrameCount;
+		summary.wallSeconds = this->lastRunSeconds;
+
+		for (const WorldResult& result : this->results)
+		{
+			summary.totalBalls += result.ballCount;
+			summary.meanKineticEnergy += result.kineticEnergy;
+			summary.maxSpeed = std::max(summary.maxSpeed, result.maxSpeed);
+			summary.counters.merge(result.counters);
+		}
+
+		if (summary.worldCount > 0)
+			summary.meanKineticEnergy /= static_cast<float>(summary.worldCount);
+
+		if (summary.wallSeconds > 0.0)
+			summary.worldFramesPerSecond = static_cast<double>(summary.totalWorldFrames) / summary.wallSeconds;
+
+		return summary;
+	}
+};
@@ -60,7 +60,7 @@ struct SquareButton
 		this->setPressFunction(function);
 	}
 
-	void render(sf::RenderWindow& window)
+	void render(sf::RenderTarget& window)
 	{
 		window.draw(this->buttShape);
 		window.draw(this->buttonText);
@@ -13,12 +13,14 @@ private:
 	std::vector<SquareButton*> managedButtons; // all buttons to manage the updates of
 	std::vector<std::pair<SquareButton*, sf::Color>> pressedButtons; // buttons pressed that need their colors reset
 	bool buttonPressed = false;
+	bool needsRedraw = true; // set whenever a button's look changes, the cached ui layer is redrawn then
 
 public:
 	SquareButton* AddButton(std::string title, sf::Vector2f position, sf::Vector2f size, std::function<void(SquareButton* button)> function, sf::Font& font)
 	{
 		SquareButton* newButton = new SquareButton(title, position, size, function, font);
 		managedButtons.push_back(newButton);
+		needsRedraw = true;
 		return newButton;
 	}
 
@@ -35,22 +37,35 @@ public:
                     pressedButtons.push_back(std::make_pair(obj, obj->buttShape.getFillColor()));
 					obj->buttShape.setFillColor(obj->buttShape.getFillColor() + sf::Color(50, 50, 50, 0));
 					obj->press();
+					needsRedraw = true;
 				}
 			}
 		}
 
-		if (!sf::Mouse::isButtonPressed(sf::Mouse::Button::Left)) // not clicked
+		if (!sf::Mouse::isButtonPressed(sf::Mouse::Button::Left) && !pressedButtons.empty()) // released, put the colors back once
 		{
-			buttonPressed = false;
-
 			for (std::pair<SquareButton*, sf::Color> obj : pressedButtons)
 			{
 				obj.first->buttShape.setFillColor(obj.second);
 			}
+			pressedButtons.clear();
+			needsRedraw = true;
 		}
+
+		if (!sf::Mouse::isButtonPressed(sf::Mouse::Button::Left)) // not clicked
+		{
+			buttonPressed = false;
+		}
+	}
+
+	bool consumeRedraw() // true once after any change to how the buttons look
+	{
+		const bool redraw = needsRedraw;
+		needsRedraw = false;
+		return redraw;
 	}
 
-	void render(sf::RenderWindow& window)
+	void render(sf::RenderTarget& window)
 	{
 		for (SquareButton* obj : managedButtons)
 		{
@@ -1,27 +1,770 @@
 // Project Specific Includes (custom)
+#include "BallFlow.h"
+#include "FixedPointSolver.h"
+#include "FluidSolver.h"
 #include "Game.h"
+#include "ImageReplay.h"
+#include "PhysicsSolver3D.h"
+#include "SoftwareRasterizer.h"
+#include "SpatialQueries.h"
+#include "WorldBatch.h"
+#include "util/alloc_tracker.h"
 //#include <Windows.h>
 
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+// scatters balls uniformly over the collider, seeded so headless runs are repeatable
+void spawnRandomBalls(PhysSolver& world, size_t count, unsigned int seed)
+{
+	std::mt19937 rng(seed);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	const float spawnRadius = world.collider_radius - world.obj_radius;
+	for (size_t i = 0; i < count; i++)
+	{
+		const float angle = unit(rng) * 6.2831853f;
+		const float dist = std::sqrt(unit(rng)) * spawnRadius;
+		world.addVerletObject(world.collider_pos + sf::Vector2f(std::cos(angle) * dist, std::sin(angle) * dist));
+	}
+}
+
+// runs a headless parameter sweep: every world gets the same ball count and a different sideways gravity
+int runWorldBatch(size_t worldCount, size_t ballsPerWorld, size_t frameCount)
+{
+	WorldBatch batch;
+	batch.setupWorld = [ballsPerWorld, worldCount](PhysSolver& world, size_t worldIndex) {
+		spawnRandomBalls(world, ballsPerWorld, static_cast<unsigned int>(worldIndex));
+		world.gravity.x = -500.f + 1000.f * static_cast<float>(worldIndex) / static_cast<float>(std::max<size_t>(1, worldCount - 1));
+	};
+
+	batch.run(worldCount, frameCount, 1.f / 30.f);
+
+	const WorldBatchSummary summary = batch.summarize();
+	std::cout << "Worlds: " << summary.worldCount << "  Balls: " << summary.totalBalls << "  Frames/world: " << frameCount << "\n"
+		<< "Wall time: " << summary.wallSeconds << " s  (" << summary.worldFramesPerSecond << " world frames/s)\n"
+		<< "Mean kinetic energy: " << summary.meanKineticEnergy << "  Max speed: " << summary.maxSpeed << "\n";
+
+	if (solverCountersEnabled)
+	{
+		std::cout << "Pairs tested: " << summary.counters.pairsTested << "  Contacts: " << summary.counters.contactsResolved
+			<< "  Wall hits: " << summary.counters.boundaryHits + summary.counters.segmentHits << "  Max overlap: " << summary.counters.maxOverlap << " px\n";
+	}
+
+	return 0;
+}
+
+// simulates a scene without a window and writes one frame drawn by the software rasterizer
+int runHeadlessRender(const char* outputPath, size_t ballCount, size_t frameCount, unsigned int width, unsigned int height)
+{
+	ThreadPool pool;
+	PhysSolver world;
+	world.threadPool = &pool;
+
+	spawnRandomBalls(world, ballCount, 1);
+	for (size_t frame = 0; frame < frameCount; frame++)
+	{
+		world.update(1.f / 30.f);
+	}
+
+	// same framing as the window: the 800x600 scene, widened to the output's aspect ratio
+	const float viewHeight = 600.f;
+	const float viewWidth = viewHeight * static_cast<float>(width) / static_cast<float>(height);
+	const sf::FloatRect view(world.collider_pos.x - viewWidth * 0.5f, world.collider_pos.y - viewHeight * 0.5f, viewWidth, viewHeight);
+
+	SoftwareRasterizer rasterizer;
+	const auto renderStart = std::chrono::steady_clock::now();
+	rasterizer.render(world, view, width, height, &pool);
+	const double renderMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - renderStart).count();
+
+	std::cout << "Rendered " << world.verletObjList.size() << " balls at " << width << "x" << height << " in " << renderMs << " ms\n";
+
+	if (!rasterizer.saveToFile(outputPath))
+	{
+		std::cout << "Error saving " << outputPath << "\n";
+		return 1;
+	}
+	return 0;
+}
+
+// both showcase passes without a window, writes the final coloured pile with the software rasterizer
+int runHeadlessShowcase(const char* imagePath, const char* outputPath)
+{
+	sf::Image image;
+	if (!image.loadFromFile(imagePath))
+	{
+		std::cout << "Error loading " << imagePath << "\n";
+		return 1;
+	}
+
+	ThreadPool pool;
+	PhysSolver world;
+	world.threadPool = &pool;
+
+	ImageReplay showcase;
+	const double passSeconds = showcase.computeColors(image, world, &pool);
+	const size_t targetFrame = showcase.script.getTargetFrame();
+	std::cout << "Headless pass: " << targetFrame << " frames in " << passSeconds << " s ("
+		<< (targetFrame * showcase.script.dt) / passSeconds << "x real time)\n";
+
+	for (size_t frame = 0; frame < targetFrame; frame++)
+	{
+		showcase.replayFrame(world, frame);
+	}
+
+	const bool matched = showcase.verifyReplay(world);
+	std::cout << "Replay " << (matched ? "matched" : "DIVERGED from") << " the headless pass\n";
+
+	SoftwareRasterizer rasterizer;
+	const float side = world.collider_radius * 2.f;
+	rasterizer.render(world, sf::FloatRect(world.collider_pos.x - side * 0.5f, world.collider_pos.y - side * 0.5f, side, side), 1024, 1024, &pool);
+	if (!rasterizer.saveToFile(outputPath))
+	{
+		std::cout << "Error saving " << outputPath << "\n";
+		return 1;
+	}
+
+	return matched ? 0 : 1;
+}
+
+// runs one scene at the world origin and again far away in each precision mode, prints how far the far runs drift from it
+int runPrecisionTest(double offset, size_t ballCount, size_t frameCount)
+{
+	ThreadPool pool;
+
+	auto simulate = [&](PhysSolver& world) {
+		world.threadPool = &pool;
+		spawnRandomBalls(world, ballCount, 1);
+		for (size_t frame = 0; frame < frameCount; frame++)
+		{
+			world.update(1.f / 30.f);
+		}
+	};
+
+	PhysSolver reference;
+	simulate(reference);
+	const sf::Vector2<double> referenceCollider = reference.localToWorld(reference.collider_pos);
+
+	const PositionPrecision modes[] = { PositionPrecision::Absolute, PositionPrecision::RegionRelative };
+	for (PositionPrecision precision : modes)
+	{
+		PhysSolver world;
+		world.placeRegion(referenceCollider + sf::Vector2<double>(offset, offset), precision);
+		simulate(world);
+
+		double maxError = 0.0;
+		double meanError = 0.0;
+		for (size_t i = 0; i < world.verletObjList.size(); i++)
+		{
+			const sf::Vector2<double> moved = world.localToWorld(world.verletObjList[i].curPos) - sf::Vector2<double>(offset, offset);
+			const sf::Vector2<double> expected = reference.localToWorld(reference.verletObjList[i].curPos);
+			const double error = std::sqrt((moved.x - expected.x) * (moved.x - expected.x) + (moved.y - expected.y) * (moved.y - expected.y));
+			maxError = std::max(maxError, error);
+			meanError += error;
+		}
+		meanError /= static_cast<double>(std::max<size_t>(1, world.verletObjList.size()));
+
+		std::cout << positionPrecisionName(precision) << " at " << offset << ": mean drift " << meanError << " px, max " << maxError << " px\n";
+	}
+
+	return 0;
+}
+
+// packs balls on whole pixel positions inside the collider, exact in float and fixed point so both solvers start identical
+void spawnLatticeBalls(PhysSolver& world, size_t count, int spacing)
+{
+	const int limit = static_cast<int>(world.collider_radius - world.obj_radius) - 1;
+	for (int y = -limit; y <= limit && world.verletObjList.size() < count; y += spacing)
+	{
+		const int rowShift = ((y + limit) / spacing) % 2 * (spacing / 2);
+		for (int x = -limit + rowShift; x <= limit && world.verletObjList.size() < count; x += spacing)
+		{
+			if (x * x + y * y <= limit * limit)
+				world.addVerletObject(world.collider_pos + sf::Vector2f(static_cast<float>(x), static_cast<float>(y)));
+		}
+	}
+}
+
+// times the float and fixed point solvers on the same scene, the printed hash should match between any two builds
+int runFixedPointBenchmark(size_t ballCount, size_t frameCount, int subSteps)
+{
+	const float dt = 1.f / 30.f;
+	ThreadPool pool;
+
+	PhysSolver floatWorld;
+	floatWorld.min_sub_steps = subSteps; // same fixed step count as the integer solver
+	floatWorld.max_sub_steps = subSteps;
+	spawnLatticeBalls(floatWorld, ballCount, 6);
+
+	FixedPointSolver single;
+	single.loadFrom(floatWorld, dt, subSteps);
+	FixedPointSolver pooled;
+	pooled.loadFrom(floatWorld, dt, subSteps);
+	pooled.threadPool = &pool;
+
+	// the pile is chaotic (nudging one ball by 0.001 px moves the whole pile within a couple of seconds),
+	// so how closely the integer kernels follow the float ones is measured over the first frame only
+	double drift = 0.0;
+	{
+		PhysSolver reference;
+		reference.min_sub_steps = subSteps;
+		reference.max_sub_steps = subSteps;
+		spawnLatticeBalls(reference, ballCount, 6);
+		FixedPointSolver check;
+		check.loadFrom(reference, dt, subSteps);
+
+		reference.update(dt);
+		check.update();
+		for (size_t i = 0; i < check.size(); i++)
+		{
+			const sf::Vector2f fixedPos(FixedToFloat(check.curX[i]), FixedToFloat(check.curY[i]));
+			drift += EuclideanDist2D(fixedPos, reference.verletObjList[i].curPos);
+		}
+		drift /= static_cast<double>(std::max<size_t>(1, check.size()));
+	}
+
+	typedef std::chrono::steady_clock Clock;
+	auto timeFrames = [frameCount](auto&& step) {
+		const Clock::time_point start = Clock::now();
+		for (size_t frame = 0; frame < frameCount; frame++)
+		{
+			step();
+		}
+		return std::chrono::duration<double, std::milli>(Clock::now() - start).count() / static_cast<double>(std::max<size_t>(1, frameCount));
+	};
+
+	const double floatMs = timeFrames([&]() { floatWorld.update(dt); });
+	const double fixedMs = timeFrames([&]() { single.update(); });
+
+	floatWorld.threadPool = &pool;
+	const double floatPooledMs = timeFrames([&]() { floatWorld.update(dt); });
+	const double fixedPooledMs = timeFrames([&]() { pooled.update(); });
+
+	std::cout << single.size() << " balls, " << frameCount << " frames of " << subSteps << " substeps\n"
+		<< "float: " << floatMs << " ms/frame single threaded, " << floatPooledMs << " ms/frame pooled\n"
+		<< "fixed: " << fixedMs << " ms/frame single threaded, " << fixedPooledMs << " ms/frame pooled\n"
+		<< "mean distance between the float and fixed balls after one frame: " << drift << " px\n"
+		<< "fixed state hash: " << std::hex << single.stateHash() << std::dec << "\n";
+
+	if (single.stateHash() != pooled.stateHash())
+	{
+		std::cout << "FAIL: pooled fixed point run differs from the single threaded one\n";
+		return 1;
+	}
+
+	std::cout << "PASS: pooled and single threaded fixed point runs are identical\n";
+	return 0;
+}
+
+// times the 3D pile, with a 2D pile of the same ball count as a reference, and checks the 3D balls stayed in their sphere
+int runBenchmark3D(size_t ballCount, size_t frameCount)
+{
+	const float dt = 1.f / 30.f;
+	ThreadPool pool;
+
+	PhysSolver3D world;
+	world.threadPool = &pool;
+
+	std::mt19937 rng(1);
+	std::uniform_real_distribution<float> unit(-1.f, 1.f);
+	const float spawnRadius = world.collider_radius - world.obj_radius;
+	while (world.balls.size() < ballCount) // uniform in the sphere by rejection
+	{
+		const sf::Vector3f p(unit(rng), unit(rng), unit(rng));
+		if (LengthSq(p) <= 1.f)
+			world.addBall(world.collider_pos + p * spawnRadius);
+	}
+
+	PhysSolver flat;
+	flat.threadPool = &pool;
+	flat.min_sub_steps = world.sub_steps;
+	flat.max_sub_steps = world.sub_steps;
+	spawnRandomBalls(flat, ballCount, 1);
+
+	typedef std::chrono::steady_clock Clock;
+	const Clock::time_point start3D = Clock::now();
+	for (size_t frame = 0; frame < frameCount; frame++)
+	{
+		world.update(dt);
+	}
+	const double ms3D = std::chrono::duration<double, std::milli>(Clock::now() - start3D).count() / static_cast<double>(std::max<size_t>(1, frameCount));
+
+	const Clock::time_point start2D = Clock::now();
+	for (size_t frame = 0; frame < frameCount; frame++)
+	{
+		flat.update(dt);
+	}
+	const double ms2D = std::chrono::duration<double, std::milli>(Clock::now() - start2D).count() / static_cast<double>(std::max<size_t>(1, frameCount));
+
+	float maxRadius = 0.f;
+	float meanHeight = 0.f;
+	for (const PhysSolver3D::Ball& ball : world.balls)
+	{
+		maxRadius = std::max(maxRadius, EuclideanDist(ball.curPos, world.collider_pos));
+		meanHeight += ball.curPos.y - world.collider_pos.y;
+	}
+	meanHeight /= static_cast<float>(std::max<size_t>(1, world.balls.size()));
+
+	std::cout << ballCount << " balls, " << frameCount << " frames of " << world.sub_steps << " substeps\n"
+		<< "3D: " << ms3D << " ms/frame, " << world.counters.contactsResolved << " contacts in the last frame\n"
+		<< "2D: " << ms2D << " ms/frame, " << flat.stats.counters.contactsResolved << " contacts in the last frame\n"
+		<< "3D pile: furthest ball " << maxRadius << " from the centre (limit " << world.collider_radius - world.obj_radius
+		<< "), mean height " << meanHeight << " (positive is below the centre)\n";
+
+	if (maxRadius > world.collider_radius - world.obj_radius + 0.01f)
+	{
+		std::cout << "FAIL: balls left the collider sphere\n";
+		return 1;
+	}
+	return 0;
+}
+
+// fills the bottom of a collider sized for the particle count with a square lattice at rest spacing, about half full
+void spawnFluidPool(FluidSolver& fluid, size_t particleCount)
+{
+	const float cellSize = PhysSolver::obj_radius * 2.f;
+	const float spacing = cellSize * 0.5f;
+	const float limit = std::sqrt(static_cast<float>(particleCount) * spacing * spacing / (0.45f * 3.14159265f));
+	fluid.configure(sf::Vector2f(), limit, cellSize);
+	fluid.clear();
+	for (float y = limit - spacing * 0.5f; y > -limit && fluid.size() < particleCount; y -= spacing) // bottom row first
+	{
+		for (float x = -limit; x <= limit && fluid.size() < particleCount; x += spacing)
+		{
+			if (x * x + y * y <= limit * limit)
+				fluid.addParticle(sf::Vector2f(x, y));
+		}
+	}
+}
+
+// times the fluid mode on a pool sloshing under sideways gravity and checks the pooled run matches a single threaded one,
+// threadCount counts the calling thread
+int runFluidBenchmark(size_t particleCount, size_t frameCount, int iterations, size_t threadCount)
+{
+	const float dt = 1.f / 30.f;
+	ThreadPool pool(std::max<size_t>(1, threadCount) - 1);
+
+	FluidSolver pooled;
+	spawnFluidPool(pooled, particleCount);
+	pooled.gravity = sf::Vector2f(400.f, 1000.f);
+	pooled.iterations = iterations;
+	pooled.threadPool = &pool;
+
+	FluidSolver single;
+	spawnFluidPool(single, particleCount);
+	single.gravity = pooled.gravity;
+	single.iterations = iterations;
+
+	typedef std::chrono::steady_clock Clock;
+	int subSteps = 0;
+	const Clock::time_point start = Clock::now();
+	for (size_t frame = 0; frame < frameCount; frame++)
+	{
+		pooled.update(dt);
+		subSteps += pooled.subSteps;
+	}
+	const double ms = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / static_cast<double>(std::max<size_t>(1, frameCount));
+
+	const size_t checkFrames = std::min<size_t>(frameCount, 10);
+	FluidSolver checked;
+	spawnFluidPool(checked, particleCount);
+	checked.gravity = pooled.gravity;
+	checked.iterations = iterations;
+	checked.threadPool = &pool;
+	for (size_t frame = 0; frame < checkFrames; frame++)
+	{
+		checked.update(dt);
+		single.update(dt);
+	}
+
+	float maxError = 0.f;
+	float meanError = 0.f;
+	pooled.densityError(maxError, meanError);
+
+	std::cout << pooled.size() << " particles, " << frameCount << " frames, " << iterations << " iterations per substep, "
+		<< pool.getThreadCount() + 1 << " threads\n"
+		<< "fluid: " << ms << " ms/frame (" << 1000.0 / ms << " fps), " << static_cast<float>(subSteps) / static_cast<float>(std::max<size_t>(1, frameCount)) << " substeps per frame\n"
+		<< "density above rest after the last frame: " << maxError * 100.f << "% max, " << meanError * 100.f << "% mean\n";
+
+	if (checked.stateHash() != single.stateHash())
+	{
+		std::cout << "FAIL: pooled fluid run differs from the single threaded one\n";
+		return 1;
+	}
+
+	std::cout << "PASS: pooled and single threaded fluid runs are identical\n";
+	return 0;
+}
+
+// fails if PhysSolver::update touches the heap once warmed up, needs a build with VERLET_TRACK_ALLOCATIONS
+int runAllocationTest(size_t ballCount, size_t warmupFrames, size_t measuredFrames)
+{
+	if (!AllocTracker::isEnabled())
+	{
+		std::cout << "Allocation tracking is not compiled in, define VERLET_TRACK_ALLOCATIONS\n";
+		return 2;
+	}
+
+	ThreadPool pool;
+	PhysSolver world;
+	world.threadPool = &pool;
+	world.ballColorMode = BallColorMode::Pressure; // also exercises the contact counters
+
+	spawnRandomBalls(world, ballCount, 1);
+	for (size_t frame = 0; frame < warmupFrames; frame++)
+	{
+		world.update(1.f / 30.f);
+	}
+
+	const AllocCounts before = AllocTracker::getCounts(AllocPhase::Physics);
+	{
+		AllocScope scope(AllocPhase::Physics);
+		for (size_t frame = 0; frame < measuredFrames; frame++)
+		{
+			world.update(1.f / 30.f);
+		}
+	}
+	const AllocCounts allocated = AllocTracker::getCounts(AllocPhase::Physics) - before;
+
+	std::cout << measuredFrames << " frames of " << ballCount << " balls after " << warmupFrames << " warm up frames: "
+		<< allocated.allocations << " allocations, " << allocated.bytes << " bytes\n";
+
+	if (allocated.allocations != 0)
+	{
+		std::cout << "FAIL: PhysSolver::update allocated in steady state\n";
+		return 1;
+	}
+
+	std::cout << "PASS\n";
+	return 0;
+}
+
+// runs the fountain scene headless, fails if emitting and draining balls allocates once the flow is steady
+int runFlowTest(size_t warmupFrames, size_t measuredFrames)
+{
+	if (!AllocTracker::isEnabled())
+	{
+		std::cout << "Allocation tracking is not compiled in, define VERLET_TRACK_ALLOCATIONS\n";
+		return 2;
+	}
+
+	ThreadPool pool;
+	PhysSolver world;
+	world.threadPool = &pool;
+	BallFlow flow;
+	flow.addFountain(world.collider_pos);
+
+	const float dt = 1.f / 30.f;
+	for (size_t frame = 0; frame < warmupFrames; frame++)
+	{
+		flow.update(world, dt);
+		world.update(dt);
+	}
+
+	const AllocCounts before = AllocTracker::getCounts(AllocPhase::Physics);
+	size_t fewestBalls = world.verletObjList.size();
+	size_t mostBalls = fewestBalls;
+	{
+		AllocScope scope(AllocPhase::Physics);
+		for (size_t frame = 0; frame < measuredFrames; frame++)
+		{
+			flow.update(world, dt);
+			world.update(dt);
+			fewestBalls = std::min(fewestBalls, world.verletObjList.size());
+			mostBalls = std::max(mostBalls, world.verletObjList.size());
+		}
+	}
+	const AllocCounts allocated = AllocTracker::getCounts(AllocPhase::Physics) - before;
+
+	std::cout << measuredFrames << " frames after " << warmupFrames << " warm up frames: " << flow.stats.emitted << " emitted, "
+		<< flow.stats.removedBySinks << " drained, " << flow.stats.expired << " expired, " << fewestBalls << " to " << mostBalls << " balls alive\n"
+		<< allocated.allocations << " allocations, " << allocated.bytes << " bytes\n";
+
+	if (allocated.allocations != 0)
+	{
+		std::cout << "FAIL: the flow allocated in steady state\n";
+		return 1;
+	}
+
+	std::cout << "PASS\n";
+	return 0;
+}
+
+// checks every grid query against a scan of all balls at random spots, then runs the same queries from the pool's threads at
+// once and checks they give the serial answers
+int runQueryTest(size_t ballCount, size_t queryCount)
+{
+	ThreadPool pool;
+	PhysSolver world;
+	world.threadPool = &pool;
+	spawnRandomBalls(world, ballCount, 3);
+	for (int frame = 0; frame < 30; frame++) // balls have moved since the last grid build, which the queries must allow for
+	{
+		world.update(1.f / 30.f);
+	}
+
+	struct Query
+	{
+		sf::Vector2f point;
+		float radius;
+		sf::FloatRect rect;
+		size_t k;
+		sf::Vector2f direction;
+		float maxDistance;
+	};
+
+	struct Answer
+	{
+		std::vector<uint32_t> inCircle; // sorted
+		std::vector<uint32_t> inRect; // sorted
+		std::vector<uint32_t> nearest; // nearest first
+		bool rayHit = false;
+		BallRayHit ray;
+	};
+
+	std::mt19937 rng(4);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	const float reach = world.collider_radius * 1.2f; // some queries start outside the collider
+	std::vector<Query> queries(queryCount);
+	for (Query& query : queries)
+	{
+		query.point = world.collider_pos + sf::Vector2f((unit(rng) * 2.f - 1.f) * reach, (unit(rng) * 2.f - 1.f) * reach);
+		query.radius = unit(rng) * world.collider_radius * 0.3f;
+		query.rect = sf::FloatRect(query.point, sf::Vector2f(unit(rng), unit(rng)) * world.collider_radius * 0.4f);
+		query.k = 1 + static_cast<size_t>(unit(rng) * 20.f);
+		const float angle = unit(rng) * 6.2831853f;
+		query.direction = sf::Vector2f(std::cos(angle), std::sin(angle)) * (0.5f + unit(rng) * 10.f);
+		query.maxDistance = unit(rng) * world.collider_radius * 2.f;
+	}
+
+	auto ask = [&world](const Query& query, Answer& answer) {
+		answer.inCircle.clear();
+		answer.inRect.clear();
+		QueryBallsInCircle(world, query.point, query.radius, answer.inCircle);
+		QueryBallsInRect(world, query.rect, answer.inRect);
+		std::sort(answer.inCircle.begin(), answer.inCircle.end());
+		std::sort(answer.inRect.begin(), answer.inRect.end());
+		QueryNearestBalls(world, query.point, query.k, answer.nearest);
+		answer.rayHit = RaycastBalls(world, query.point, query.direction, query.maxDistance, answer.ray);
+	};
+
+	// the brute force answers use the same tests on every ball
+	const float r = world.obj_radius;
+	auto center = [&world, r](uint32_t i) { return world.verletObjList[i].curPos + sf::Vector2f(r, r); };
+	auto scan = [&](const Query& query, Answer& answer) {
+		answer.inCircle.clear();
+		answer.inRect.clear();
+		answer.rayHit = false;
+		const float circleReach = query.radius + r;
+		const sf::Vector2f low(query.rect.left, query.rect.top);
+		const sf::Vector2f high(query.rect.left + query.rect.width, query.rect.top + query.rect.height);
+		const sf::Vector2f dir = query.direction / std::sqrt(LengthSq(query.direction));
+		const sf::Vector2f rayEnd = query.point + dir * query.maxDistance;
+		std::vector<std::pair<float, uint32_t>> byDistance;
+		for (uint32_t i = 0; i < world.verletObjList.size(); i++)
+		{
+			const sf::Vector2f c = center(i);
+			if (EuclideanDistSq(c, query.point) <= circleReach * circleReach)
+				answer.inCircle.push_back(i);
+
+			const sf::Vector2f closest(std::max(low.x, std::min(high.x, c.x)), std::max(low.y, std::min(high.y, c.y)));
+			if (EuclideanDistSq(c, closest) <= r * r)
+				answer.inRect.push_back(i);
+
+			byDistance.push_back(std::make_pair(EuclideanDistSq(c, query.point), i));
+
+			float distance = 0.f;
+			if (EuclideanDistSq(query.point, c) > r * r)
+			{
+				const float t = RayCircleHit2D(query.point, rayEnd, c, r);
+				if (t < 0.f)
+					continue;
+				distance = t * query.maxDistance;
+			}
+			if (distance <= query.maxDistance && (!answer.rayHit || distance < answer.ray.distance))
+			{
+				answer.rayHit = true;
+				answer.ray.objIndex = i;
+				answer.ray.distance = distance;
+			}
+		}
+
+		const size_t k = std::min(query.k, byDistance.size());
+		std::partial_sort(byDistance.begin(), byDistance.begin() + k, byDistance.end());
+		answer.nearest.clear();
+		for (size_t i = 0; i < k; i++)
+		{
+			answer.nearest.push_back(byDistance[i].second);
+		}
+	};
+
+	// k nearest may order equally distant balls either way, so those compare by distance
+	auto sameNearest = [&](const Query& query, const std::vector<uint32_t>& a, const std::vector<uint32_t>& b) {
+		if (a.size() != b.size())
+			return false;
+		for (size_t i = 0; i < a.size(); i++)
+		{
+			if (EuclideanDistSq(center(a[i]), query.point) != EuclideanDistSq(center(b[i]), query.point))
+				return false;
+		}
+		return true;
+	};
+
+	std::vector<Answer> serial(queryCount);
+	Answer expected;
+	size_t failures = 0;
+	for (size_t q = 0; q < queryCount; q++)
+	{
+		ask(queries[q], serial[q]);
+		scan(queries[q], expected);
+		const Answer& got = serial[q];
+		const bool rayMatches = got.rayHit == expected.rayHit && (!got.rayHit || got.ray.distance == expected.ray.distance);
+		if (got.inCircle != expected.inCircle || got.inRect != expected.inRect || !sameNearest(queries[q], got.nearest, expected.nearest) || !rayMatches)
+		{
+			if (failures++ < 10)
+				std::cout << "query " << q << " differs from the scan:" << (got.inCircle != expected.inCircle ? " circle" : "")
+					<< (got.inRect != expected.inRect ? " rect" : "") << (!sameNearest(queries[q], got.nearest, expected.nearest) ? " nearest" : "")
+					<< (!rayMatches ? " ray" : "") << "\n";
+		}
+	}
+
+	// read only, so the threads share the solver without locks
+	std::vector<Answer> threaded(queryCount);
+	pool.parallelFor(0, queryCount, 16, [&](size_t first, size_t last) {
+		for (size_t q = first; q < last; q++)
+		{
+			ask(queries[q], threaded[q]);
+		}
+	});
+
+	size_t threadedFailures = 0;
+	for (size_t q = 0; q < queryCount; q++)
+	{
+		const Answer& a = serial[q];
+		const Answer& b = threaded[q];
+		if (a.inCircle != b.inCircle || a.inRect != b.inRect || a.nearest != b.nearest || a.rayHit != b.rayHit
+			|| (a.rayHit && (a.ray.objIndex != b.ray.objIndex || a.ray.distance != b.ray.distance)))
+			threadedFailures++;
+	}
+
+	std::cout << queryCount << " circle, rect, nearest and ray queries on " << ballCount << " balls: " << failures
+		<< " differ from the scan, " << threadedFailures << " differ when run on the pool\n";
+
+	if (failures != 0 || threadedFailures != 0)
+	{
+		std::cout << "FAIL\n";
+		return 1;
+	}
+
+	std::cout << "PASS\n";
+	return 0;
+}
+
 //int WINAPI WinMain(HINSTANCE hThisInstance, HINSTANCE hPrevInstance, LPSTR lpszArgument, int nCmdShow)
-int main()
+int main(int argc, char* argv[])
 {
     // SRand seed initialization
     std::srand(static_cast<unsigned>(time(NULL)));
 
+    // headless modes
+    if (argc >= 2 && std::strcmp(argv[1], "--batch") == 0)
+    {
+        const size_t worldCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000;
+        const size_t ballsPerWorld = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 5000;
+        const size_t frameCount = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 60;
+        return runWorldBatch(worldCount, ballsPerWorld, frameCount);
+    }
+
+    if (argc >= 3 && std::strcmp(argv[1], "--render") == 0)
+    {
+        const size_t ballCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 3000;
+        const size_t frameCount = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 60;
+        const unsigned int width = argc > 5 ? static_cast<unsigned int>(std::strtoul(argv[5], nullptr, 10)) : 1920;
+        const unsigned int height = argc > 6 ? static_cast<unsigned int>(std::strtoul(argv[6], nullptr, 10)) : 1080;
+        return runHeadlessRender(argv[2], ballCount, frameCount, width, height);
+    }
+
+    if (argc >= 4 && std::strcmp(argv[1], "--showcase") == 0)
+    {
+        return runHeadlessShowcase(argv[2], argv[3]);
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--precision-test") == 0)
+    {
+        const double offset = argc > 2 ? std::atof(argv[2]) : 1000000.0;
+        const size_t ballCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 3000;
+        const size_t frameCount = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 120;
+        return runPrecisionTest(offset, ballCount, frameCount);
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--fixed-bench") == 0)
+    {
+        const size_t ballCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5000;
+        const size_t frameCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 300;
+        const int subSteps = argc > 4 ? std::atoi(argv[4]) : 8;
+        return runFixedPointBenchmark(ballCount, frameCount, subSteps);
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--bench3d") == 0)
+    {
+        const size_t ballCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5000;
+        const size_t frameCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 300;
+        return runBenchmark3D(ballCount, frameCount);
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--fluid-bench") == 0)
+    {
+        const size_t particleCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+        const size_t frameCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 120;
+        const int iterations = argc > 4 ? std::atoi(argv[4]) : 2;
+        const size_t threadCount = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : ThreadPool::defaultThreadCount() + 1;
+        return runFluidBenchmark(particleCount, frameCount, iterations, threadCount);
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--flow-test") == 0)
+    {
+        const size_t warmupFrames = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1800;
+        const size_t measuredFrames = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 3600;
+        return runFlowTest(warmupFrames, measuredFrames);
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--query-test") == 0)
+    {
+        const size_t ballCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5000;
+        const size_t queryCount = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 2000;
+        return runQueryTest(ballCount, queryCount);
+    }
+
+    if (argc >= 2 && std::strcmp(argv[1], "--alloc-test") == 0)
+    {
+        const size_t ballCount = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 5000;
+        const size_t warmupFrames = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 60;
+        const size_t measuredFrames = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 300;
+        return runAllocationTest(ballCount, warmupFrames, measuredFrames);
+    }
+
     // Init game engine
     Game game;
 
     // Debug
     game.setDisplayTitleFps(false);
 
+    // sleep between frames instead of spinning, --fps 0 runs unlimited
+    float targetFramerate = 60.f;
+    if (argc >= 3 && std::strcmp(argv[1], "--fps") == 0)
+        targetFramerate = static_cast<float>(std::atof(argv[2]));
+    game.setTargetFramerate(targetFramerate);
+
     while (game.getIsRunning())
     {
         // Update
         game.update();
-        
+
         // Render
         game.render();
     }
 
     return 0;
-}
\ No newline at end of file
+}
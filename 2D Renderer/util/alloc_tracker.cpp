@@ -0,0 +1,136 @@
+#include "alloc_tracker.h"
+
+// std includes
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	const size_t phaseCount = static_cast<size_t>(AllocPhase::Count);
+
+	// plain atomics are constant initialised, so they are usable by allocations made before main
+	std::atomic<int> currentPhase{ static_cast<int>(AllocPhase::Other) };
+	std::atomic<uint64_t> allocationCounts[phaseCount];
+	std::atomic<uint64_t> allocationBytes[phaseCount];
+	thread_local bool threadIgnored = false;
+}
+
+bool AllocTracker::isEnabled()
+{
+#ifdef VERLET_TRACK_ALLOCATIONS
+	return true;
+#else
+	return false;
+#endif
+}
+
+AllocPhase AllocTracker::getPhase()
+{
+	return static_cast<AllocPhase>(currentPhase.load(std::memory_order_relaxed));
+}
+
+void AllocTracker::setPhase(AllocPhase phase)
+{
+	currentPhase.store(static_cast<int>(phase), std::memory_order_relaxed);
+}
+
+void AllocTracker::ignoreThisThread()
+{
+	threadIgnored = true;
+}
+
+AllocCounts AllocTracker::getCounts(AllocPhase phase)
+{
+	AllocCounts counts;
+	counts.allocations = allocationCounts[static_cast<size_t>(phase)].load(std::memory_order_relaxed);
+	counts.bytes = allocationBytes[static_cast<size_t>(phase)].load(std::memory_order_relaxed);
+	return counts;
+}
+
+AllocCounts AllocTracker::getTotal()
+{
+	AllocCounts total;
+	for (size_t p = 0; p < phaseCount; p++)
+	{
+		const AllocCounts counts = getCounts(static_cast<AllocPhase>(p));
+		total.allocations += counts.allocations;
+		total.bytes += counts.bytes;
+	}
+	return total;
+}
+
+void AllocTracker::recordAllocation(size_t bytes)
+{
+	const size_t phase = threadIgnored ? static_cast<size_t>(AllocPhase::Other) : static_cast<size_t>(currentPhase.load(std::memory_order_relaxed));
+	allocationCounts[phase].fetch_add(1, std::memory_order_relaxed);
+	allocationBytes[phase].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+#ifdef VERLET_TRACK_ALLOCATIONS
+
+/*
+* Replacement global allocation functions, the nothrow and sized forms are replaced as well
+* so every allocation and free pairs up with malloc / free whatever the standard library picks.
+*/
+
+void* operator new(size_t size)
+{
+	AllocTracker::recordAllocation(size);
+
+	while (true)
+	{
+		void* memory = std::malloc(size == 0 ? 1 : size);
+		if (memory)
+			return memory;
+
+		std::new_handler handler = std::get_new_handler();
+		if (handler == nullptr)
+			throw std::bad_alloc();
+		handler();
+	}
+}
+
+void* operator new[](size_t size)
+{
+	return operator new(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+	return operator new(size, std::nothrow);
+}
+
+void operator delete(void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void* memory, size_t) noexcept
+{
+	std::free(memory);
+}
+
+#endif
@@ -0,0 +1,71 @@
+#pragma once
+
+// std includes
+#include <cstddef>
+#include <cstdint>
+
+/*
+* Global allocation counting
+* With VERLET_TRACK_ALLOCATIONS defined, alloc_tracker.cpp replaces the global operator new / delete and counts every
+* allocation against the phase the main loop is in (physics, render, ui). The phase is global rather than per thread
+* so allocations made by pool workers during a physics step count as physics too, threads that run alongside the loop
+* (the frame encoders) opt out with ignoreThisThread.
+* Without the define nothing is replaced and every counter stays at zero.
+*/
+
+enum class AllocPhase
+{
+	Other,
+	Physics,
+	Render,
+	UI,
+	Count
+};
+
+struct AllocCounts
+{
+	uint64_t allocations = 0;
+	uint64_t bytes = 0;
+};
+
+namespace AllocTracker
+{
+	bool isEnabled(); // true when the operators are replaced in this build
+
+	AllocPhase getPhase();
+	void setPhase(AllocPhase phase);
+	void ignoreThisThread(); // this thread's allocations always count as Other
+
+	AllocCounts getCounts(AllocPhase phase); // totals since startup
+	AllocCounts getTotal();
+
+	void recordAllocation(size_t bytes); // called by the replaced operators
+}
+
+class AllocScope // sets the phase for its lifetime
+{
+private:
+	AllocPhase previous;
+
+public:
+	explicit AllocScope(AllocPhase phase) : previous(AllocTracker::getPhase())
+	{
+		AllocTracker::setPhase(phase);
+	}
+
+	~AllocScope()
+	{
+		AllocTracker::setPhase(this->previous);
+	}
+
+	AllocScope(const AllocScope&) = delete;
+	AllocScope& operator=(const AllocScope&) = delete;
+};
+
+inline AllocCounts operator-(const AllocCounts& a, const AllocCounts& b)
+{
+	AllocCounts difference;
+	difference.allocations = a.allocations - b.allocations;
+	difference.bytes = a.bytes - b.bytes;
+	return difference;
+}
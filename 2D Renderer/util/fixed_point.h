@@ -0,0 +1,60 @@
+#pragma once
+
+// std includes
+#include <cmath>
+#include <cstdint>
+
+/*
+* Q16.16 fixed point
+* - 16 integer bits cover +-32768 px, 16 fraction bits give 1/65536 px steps
+* - products and squared lengths are taken in 64 bits, so nothing a solver in the collider can produce overflows
+* - every operation is plain integer arithmetic, the same inputs give the same bits on any compiler and CPU
+*/
+
+typedef int32_t fixed_t;
+
+const int fixed_fraction_bits = 16;
+const fixed_t fixed_one = 1 << fixed_fraction_bits;
+
+// signed right shifts are implementation defined before C++20, every compiler the project builds with shifts arithmetically
+static_assert((-3 >> 1) == -2, "fixed point needs arithmetic right shifts");
+
+inline fixed_t FloatToFixed(float value) // round to nearest, only used at the edges (loading, settings)
+{
+	return static_cast<fixed_t>(std::lround(static_cast<double>(value) * fixed_one));
+}
+
+inline float FixedToFloat(fixed_t value)
+{
+	return static_cast<float>(static_cast<double>(value) / fixed_one);
+}
+
+inline fixed_t FixedMul(fixed_t a, fixed_t b) // rounds towards -infinity
+{
+	return static_cast<fixed_t>((static_cast<int64_t>(a) * b) >> fixed_fraction_bits);
+}
+
+inline int64_t FixedLengthSq(fixed_t x, fixed_t y) // Q32.32
+{
+	return static_cast<int64_t>(x) * x + static_cast<int64_t>(y) * y;
+}
+
+// floor(sqrt(value)), so the square root of a Q32.32 length gives a Q16.16 length.
+// The double estimate is only a starting point, the fix ups make the result exact whatever the FPU rounded to.
+inline fixed_t FixedSqrt64(int64_t value)
+{
+	if (value <= 0)
+		return 0;
+
+	int64_t root = static_cast<int64_t>(std::sqrt(static_cast<double>(value)));
+	while (root * root > value)
+		root--;
+	while ((root + 1) * (root + 1) <= value)
+		root++;
+	return static_cast<fixed_t>(root);
+}
+
+inline fixed_t FixedScale(fixed_t value, fixed_t numerator, fixed_t denominator) // value * numerator / denominator, 64 bit in between, truncates towards 0
+{
+	return static_cast<fixed_t>(static_cast<int64_t>(value) * numerator / denominator);
+}
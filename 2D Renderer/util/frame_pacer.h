@@ -0,0 +1,132 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+// SFML includes
+#include <SFML/System.hpp>
+
+// custom includes
+#include "frame_stats.h"
+
+/*
+* Frame pacing, holds the loop to a target rate without burning a core
+* - sleeps until shortly before the deadline, then yields the last stretch so the wake up is on time
+* - the stretch left for yielding follows how much the sleeps have been overshooting, so it stays small where sleep is precise
+* - sf::sleep raises the OS timer resolution while sleeping on Windows, plain sleep_for would oversleep by up to ~15 ms
+* - deadlines advance by whole periods so the rate doesn't drift, a frame that runs long resyncs instead of bursting to catch up
+*/
+
+struct PacerSummary
+{
+	PhaseSummary wakeError; // how late the loop resumed after its deadline, ms
+	unsigned long long missedDeadlines = 0; // frames that were already late, nothing to wait for
+	float idleFraction = 0.f; // share of the time spent waiting since the last summary
+};
+
+class FramePacer
+{
+private:
+	typedef std::chrono::steady_clock Clock;
+
+	Clock::duration framePeriod = Clock::duration::zero(); // zero means unpaced
+	Clock::time_point nextDeadline;
+	bool started = false;
+
+	std::chrono::microseconds spinMargin{ 1000 }; // time left for yielding after the sleep
+	float sleepOvershootMicros = 1000.f; // running average of how much sf::sleep oversleeps
+
+	TimeHistogram wakeErrors;
+	unsigned long long missedDeadlines = 0;
+	Clock::duration waitedSinceSummary = Clock::duration::zero();
+	Clock::time_point summaryStart = Clock::now();
+
+public:
+	explicit FramePacer(float targetRate = 0.f)
+	{
+		this->setTargetRate(targetRate);
+	}
+
+	void setTargetRate(float framesPerSecond) // 0 or less turns pacing off
+	{
+		this->framePeriod = framesPerSecond > 0.f
+			? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond))
+			: Clock::duration::zero();
+		this->started = false;
+	}
+
+	float getTargetRate() const
+	{
+		return this->framePeriod > Clock::duration::zero() ? static_cast<float>(1.0 / std::chrono::duration<double>(this->framePeriod).count()) : 0.f;
+	}
+
+	void wait() // call once per frame after presenting, returns at the next frame deadline
+	{
+		if (this->framePeriod <= Clock::duration::zero())
+			return;
+
+		const Clock::time_point waitStart = Clock::now();
+		if (!this->started)
+		{
+			this->started = true;
+			this->nextDeadline = waitStart + this->framePeriod;
+		}
+
+		if (waitStart >= this->nextDeadline) // ran long, start the next frame now
+		{
+			this->missedDeadlines++;
+			this->nextDeadline += this->framePeriod;
+			if (this->nextDeadline <= waitStart)
+				this->nextDeadline = waitStart + this->framePeriod;
+			return;
+		}
+
+		// coarse part, sleep most of the way
+		const Clock::duration remaining = this->nextDeadline - waitStart;
+		if (remaining > this->spinMargin)
+		{
+			const std::chrono::microseconds request = std::chrono::duration_cast<std::chrono::microseconds>(remaining - this->spinMargin);
+			sf::sleep(sf::microseconds(request.count()));
+
+			const float overshoot = std::chrono::duration<float, std::micro>(Clock::now() - waitStart).count() - static_cast<float>(request.count());
+			this->sleepOvershootMicros += 0.1f * (std::max(0.f, overshoot) - this->sleepOvershootMicros);
+			this->spinMargin = std::chrono::microseconds(static_cast<long long>(std::min(4000.f, std::max(200.f, this->sleepOvershootMicros * 1.5f + 100.f))));
+		}
+
+		// fine part, give the core away a slice at a time until the deadline
+		while (Clock::now() < this->nextDeadline)
+		{
+			std::this_thread::yield();
+		}
+
+		const Clock::time_point woke = Clock::now();
+		this->wakeErrors.record(static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::microseconds>(woke - this->nextDeadline).count()));
+		this->waitedSinceSummary += woke - waitStart;
+		this->nextDeadline += this->framePeriod;
+	}
+
+	PacerSummary summarize() // also restarts the idle measurement
+	{
+		PacerSummary summary;
+		summary.wakeError.p50 = this->wakeErrors.percentile(50.0) / 1000.f;
+		summary.wakeError.p95 = this->wakeErrors.percentile(95.0) / 1000.f;
+		summary.wakeError.p99 = this->wakeErrors.percentile(99.0) / 1000.f;
+		summary.wakeError.max = this->wakeErrors.getMax() / 1000.f;
+		summary.missedDeadlines = this->missedDeadlines;
+
+		const Clock::time_point now = Clock::now();
+		const double elapsed = std::chrono::duration<double>(now - this->summaryStart).count();
+		summary.idleFraction = elapsed > 0.0 ? static_cast<float>(std::chrono::duration<double>(this->waitedSinceSummary).count() / elapsed) : 0.f;
+		this->waitedSinceSummary = Clock::duration::zero();
+		this->summaryStart = now;
+		return summary;
+	}
+
+	void resetStats()
+	{
+		this->wakeErrors.reset();
+		this->missedDeadlines = 0;
+	}
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+/*
+* Frame time statistics
+* - every phase of a frame is recorded into a log bucketed histogram (HDR style, ~3% precision from 1 us to over an hour)
+*   so percentiles cost nothing to keep and never need the samples sorted
+* - the last historyLength frames are kept in a ring with their full phase breakdown
+* - a frame over spikeThresholdMs dumps that ring to spikeLogPath, so the frames leading up to a stutter can be read after
+*/
+
+class TimeHistogram
+{
+private:
+	static const int subBucketBits = 5;
+	static const uint32_t subBucketCount = 1u << subBucketBits; // buckets per power of two
+	static const size_t bucketCount = 2 * subBucketCount + (32 - subBucketBits - 1) * subBucketCount;
+
+	uint64_t counts[bucketCount] = {};
+	uint64_t totalCount = 0;
+	uint32_t maxValue = 0;
+
+	static size_t bucketIndex(uint32_t value)
+	{
+		if (value < 2 * subBucketCount) // small values get a bucket each
+			return value;
+
+		int msb = 0;
+		while ((value >> msb) > 1)
+			msb++;
+
+		const int shift = msb - subBucketBits; // value >> shift lands in [subBucketCount, 2 * subBucketCount)
+		return 2 * subBucketCount + static_cast<size_t>(shift - 1) * subBucketCount + ((value >> shift) - subBucketCount);
+	}
+
+	static uint32_t bucketUpperValue(size_t index) // largest value that falls into the bucket
+	{
+		if (index < 2 * subBucketCount)
+			return static_cast<uint32_t>(index);
+
+		const size_t shift = (index - 2 * subBucketCount) / subBucketCount + 1;
+		const uint64_t mantissa = subBucketCount + (index - 2 * subBucketCount) % subBucketCount;
+		return static_cast<uint32_t>(std::min<uint64_t>(0xFFFFFFFFu, ((mantissa + 1) << shift) - 1));
+	}
+
+public:
+	void record(uint32_t micros)
+	{
+		this->counts[bucketIndex(micros)]++;
+		this->totalCount++;
+		this->maxValue = std::max(this->maxValue, micros);
+	}
+
+	void reset()
+	{
+		std::fill(this->counts, this->counts + bucketCount, 0);
+		this->totalCount = 0;
+		this->maxValue = 0;
+	}
+
+	uint64_t getCount() const
+	{
+		return this->totalCount;
+	}
+
+	uint32_t getMax() const
+	{
+		return this->maxValue;
+	}
+
+	uint32_t percentile(double p) const // in microseconds, p in [0, 100], reported as the top of its bucket
+	{
+		if (this->totalCount == 0)
+			return 0;
+
+		const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(p / 100.0 * static_cast<double>(this->totalCount) + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucketCount; i++)
+		{
+			seen += this->counts[i];
+			if (seen >= rank)
+				return std::min(this->maxValue, bucketUpperValue(i));
+		}
+		return this->maxValue;
+	}
+};
+
+enum class FramePhase
+{
+	Update, // events, input and ui logic
+	Physics, // the solver tick, only on frames that ran one
+	Render,
+	Capture, // reading a captured frame back into the exporter, also counted in render
+	Total, // frame start to frame start
+	Count
+};
+
+inline const char* framePhaseName(FramePhase phase)
+{
+	switch (phase)
+	{
+	case FramePhase::Update: return "update";
+	case FramePhase::Physics: return "physics";
+	case FramePhase::Render: return "render";
+	case FramePhase::Capture: return "capture";
+	case FramePhase::Total: return "total";
+	default: return "?";
+	}
+}
+
+struct PhaseSummary // milliseconds
+{
+	float p50 = 0.f;
+	float p95 = 0.f;
+	float p99 = 0.f;
+	float max = 0.f;
+};
+
+class FrameStats
+{
+private:
+	static const size_t phaseCount = static_cast<size_t>(FramePhase::Count);
+
+	struct FrameSample
+	{
+		uint64_t frameNumber = 0;
+		uint32_t phaseMicros[phaseCount] = {};
+		bool ranPhase[phaseCount] = {};
+		uint32_t subSteps = 0;
+		uint32_t ballCount = 0;
+		uint64_t contacts = 0; // solver contacts resolved, 0 in builds without solver counters
+	};
+
+	TimeHistogram histograms[phaseCount];
+	std::vector<FrameSample> history; // ring of the latest frames
+	FrameSample current;
+	uint64_t frameNumber = 0;
+	uint64_t lastSpikeDump = 0;
+	size_t spikesDumped = 0;
+
+	void dumpHistory(uint32_t spikeMicros)
+	{
+		std::FILE* file = std::fopen(this->spikeLogPath, "a");
+		if (file == nullptr)
+			return;
+
+		std::fprintf(file, "spike at frame %llu: %.3f ms\nframe,update_ms,physics_ms,render_ms,capture_ms,total_ms,substeps,balls,contacts\n",
+			static_cast<unsigned long long>(this->current.frameNumber), spikeMicros / 1000.0);
+
+		const size_t stored = static_cast<size_t>(std::min<uint64_t>(this->frameNumber, this->history.size()));
+		for (size_t i = stored; i > 0; i--) // oldest first
+		{
+			const FrameSample& sample = this->history[(this->frameNumber - i) % this->history.size()];
+			std::fprintf(file, "%llu", static_cast<unsigned long long>(sample.frameNumber));
+			for (size_t p = 0; p < phaseCount; p++)
+			{
+				std::fprintf(file, ",%.3f", sample.phaseMicros[p] / 1000.0);
+			}
+			std::fprintf(file, ",%u,%u,%llu\n", sample.subSteps, sample.ballCount, static_cast<unsigned long long>(sample.contacts));
+		}
+		std::fputs("\n", file);
+		std::fclose(file);
+
+		this->lastSpikeDump = this->frameNumber;
+		this->spikesDumped++;
+	}
+
+public:
+	float spikeThresholdMs = 50.f; // a frame longer than this triggers a dump
+	const char* spikeLogPath = "frame_spikes.csv";
+
+	explicit FrameStats(size_t historyLength = 120) : history(std::max<size_t>(1, historyLength))
+	{
+
+	}
+
+	void recordPhase(FramePhase phase, float seconds) // adds to the phase for the frame in progress
+	{
+		const size_t p = static_cast<size_t>(phase);
+		this->current.phaseMicros[p] += static_cast<uint32_t>(std::max(0.f, seconds) * 1000000.f);
+		this->current.ranPhase[p] = true;
+	}
+
+	void endFrame(float totalSeconds, int subSteps, size_t ballCount, uint64_t contacts) // closes the frame, call once per loop
+	{
+		this->recordPhase(FramePhase::Total, totalSeconds);
+		this->current.frameNumber = this->frameNumber;
+		this->current.subSteps = static_cast<uint32_t>(std::max(0, subSteps));
+		this->current.ballCount = static_cast<uint32_t>(ballCount);
+		this->current.contacts = contacts;
+
+		for (size_t p = 0; p < phaseCount; p++)
+		{
+			if (this->current.ranPhase[p])
+				this->histograms[p].record(this->current.phaseMicros[p]);
+		}
+
+		this->history[this->frameNumber % this->history.size()] = this->current;
+		this->frameNumber++;
+
+		// the ring has to refill between dumps so one long stutter doesn't write the same frames over and over
+		const uint32_t totalMicros = this->current.phaseMicros[static_cast<size_t>(FramePhase::Total)];
+		if (totalMicros > static_cast<uint32_t>(this->spikeThresholdMs * 1000.f) && (this->spikesDumped == 0 || this->frameNumber - this->lastSpikeDump >= this->history.size()))
+			this->dumpHistory(totalMicros);
+
+		this->current = FrameSample();
+	}
+
+	void reset() // clears the histograms, the history ring is kept
+	{
+		for (TimeHistogram& histogram : this->histograms)
+		{
+			histogram.reset();
+		}
+	}
+
+	PhaseSummary summarize(FramePhase phase) const
+	{
+		const TimeHistogram& histogram = this->histograms[static_cast<size_t>(phase)];
+		PhaseSummary summary;
+		summary.p50 = histogram.percentile(50.0) / 1000.f;
+		summary.p95 = histogram.percentile(95.0) / 1000.f;
+		summary.p99 = histogram.percentile(99.0) / 1000.f;
+		summary.max = histogram.getMax() / 1000.f;
+		return summary;
+	}
+
+	size_t getSpikeCount() const
+	{
+		return this->spikesDumped;
+	}
+
+	bool writeReport(const char* path) const // percentiles of every phase as a small table
+	{
+		std::FILE* file = std::fopen(path, "w");
+		if (file == nullptr)
+			return false;
+
+		std::fprintf(file, "phase,frames,p50_ms,p95_ms,p99_ms,max_ms\n");
+		for (size_t p = 0; p < phaseCount; p++)
+		{
+			const FramePhase phase = static_cast<FramePhase>(p);
+			const PhaseSummary summary = this->summarize(phase);
+			std::fprintf(file, "%s,%llu,%.3f,%.3f,%.3f,%.3f\n", framePhaseName(phase), static_cast<unsigned long long>(this->histograms[p].getCount()),
+				summary.p50, summary.p95, summary.p99, summary.max);
+		}
+		std::fprintf(file, "spike dumps,%llu\n", static_cast<unsigned long long>(this->spikesDumped));
+
+		std::fclose(file);
+		return true;
+	}
+};
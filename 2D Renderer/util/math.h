@@ -1,6 +1,7 @@
 #pragma once
 
 #include <SFML/Graphics.hpp>
+#include <algorithm>
 #include <cmath>
 
 inline float EuclideanDist2D(sf::Vector2f pos1, sf::Vector2f pos2)
@@ -15,4 +16,73 @@ inline float EuclideanDist2DSqrt(sf::Vector2f pos1, sf::Vector2f pos2)
     float n1 = pos1.x - pos2.x;
     float n2 = pos1.y - pos2.y;
     return (n1 * n1) + (n2 * n2);
-}
\ No newline at end of file
+}
+
+inline float Dot2D(sf::Vector2f a, sf::Vector2f b)
+{
+    return a.x * b.x + a.y * b.y;
+}
+
+inline float Dot3D(sf::Vector3f a, sf::Vector3f b)
+{
+    return a.x * b.x + a.y * b.y + a.z * b.z;
+}
+
+// dimension generic forms, the solver templates call these so one kernel serves sf::Vector2f and sf::Vector3f
+inline float Dot(sf::Vector2f a, sf::Vector2f b)
+{
+    return Dot2D(a, b);
+}
+
+inline float Dot(sf::Vector3f a, sf::Vector3f b)
+{
+    return Dot3D(a, b);
+}
+
+template <class Vec>
+inline float LengthSq(const Vec& v)
+{
+    return Dot(v, v);
+}
+
+template <class Vec>
+inline float EuclideanDist(const Vec& pos1, const Vec& pos2)
+{
+    return std::sqrt(LengthSq(pos2 - pos1));
+}
+
+template <class Vec>
+inline float EuclideanDistSq(const Vec& pos1, const Vec& pos2)
+{
+    return LengthSq(pos1 - pos2);
+}
+
+inline sf::Vector2f ClosestPointOnSegment2D(sf::Vector2f point, sf::Vector2f segStart, sf::Vector2f segEnd)
+{
+    const sf::Vector2f seg = segEnd - segStart;
+    const float lenSq = Dot2D(seg, seg);
+    if (lenSq <= 0.f)
+        return segStart;
+
+    const float t = std::max(0.f, std::min(1.f, Dot2D(point - segStart, seg) / lenSq));
+    return segStart + seg * t;
+}
+
+// earliest t in [0, 1] where a point moving from start to end hits a circle it starts outside of, -1 if it doesn't
+inline float RayCircleHit2D(sf::Vector2f start, sf::Vector2f end, sf::Vector2f center, float radius)
+{
+    const sf::Vector2f d = end - start;
+    const sf::Vector2f f = start - center;
+    const float a = Dot2D(d, d);
+    const float c = Dot2D(f, f) - radius * radius;
+    if (a <= 0.f || c < 0.f)
+        return -1.f;
+
+    const float b = Dot2D(f, d);
+    const float disc = b * b - a * c;
+    if (b >= 0.f || disc < 0.f)
+        return -1.f;
+
+    const float t = (-b - std::sqrt(disc)) / a;
+    return t <= 1.f ? t : -1.f;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+// std includes
+#include <atomic>
+#include <functional>
+#include <vector>
+
+// custom includes
+#include "thread_pool.h"
+
+/*
+* Small dependency graph of tasks, built once and run many times (once per substep).
+* A task is submitted to the pool as soon as everything it depends on is done, so independent
+* tasks overlap. Tasks are expected to be added in an order that already respects the dependencies,
+* that order is used when running without a pool.
+*/
+
+class TaskGraph
+{
+private:
+	struct TaskNode
+	{
+		std::function<void()> work;
+		std::vector<size_t> successors;
+		int dependencyCount = 0;
+	};
+
+	std::vector<TaskNode> nodes;
+	std::vector<std::atomic<int>> remainingDependencies; // reset every run
+	std::atomic<size_t> finishedNodes{ 0 };
+	ThreadPool* runningPool = nullptr;
+
+	void runNode(size_t index)
+	{
+		this->nodes[index].work();
+
+		for (size_t successor : this->nodes[index].successors)
+		{
+			if (this->remainingDependencies[successor].fetch_sub(1) == 1) // last dependency done
+			{
+				this->runningPool->submit([this, successor]() { this->runNode(successor); });
+			}
+		}
+
+		this->finishedNodes.fetch_add(1);
+	}
+
+public:
+	size_t addTask(std::function<void()> work) // returns the id used for dependencies
+	{
+		TaskNode node;
+		node.work = std::move(work);
+		this->nodes.push_back(std::move(node));
+		return this->nodes.size() - 1;
+	}
+
+	void addDependency(size_t before, size_t after) // after only starts once before is finished
+	{
+		this->nodes[before].successors.push_back(after);
+		this->nodes[after].dependencyCount++;
+	}
+
+	size_t getTaskCount() const
+	{
+		return this->nodes.size();
+	}
+
+	void run(ThreadPool* pool) // runs every task once, blocks until the whole graph is done
+	{
+		if (pool == nullptr || pool->getThreadCount() == 0)
+		{
+			for (TaskNode& node : this->nodes)
+			{
+				node.work();
+			}
+			return;
+		}
+
+		if (this->remainingDependencies.size() != this->nodes.size())
+			this->remainingDependencies = std::vector<std::atomic<int>>(this->nodes.size());
+
+		for (size_t i = 0; i < this->nodes.size(); i++)
+		{
+			this->remainingDependencies[i].store(this->nodes[i].dependencyCount);
+		}
+		this->finishedNodes.store(0);
+		this->runningPool = pool;
+
+		for (size_t i = 0; i < this->nodes.size(); i++)
+		{
+			if (this->nodes[i].dependencyCount == 0)
+				pool->submit([this, i]() { this->runNode(i); });
+		}
+
+		pool->helpUntil([this]() { return this->finishedNodes.load() == this->nodes.size(); });
+	}
+};
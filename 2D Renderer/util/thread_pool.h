@@ -0,0 +1,285 @@
+#pragma once
+
+// std includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/*
+* Work stealing thread pool
+* - every worker owns a queue, pushes/pops at the back and steals from the front of the others
+* - threads that are waiting on work (waitIdle) help run tasks instead of blocking
+* - threads not owned by the pool share one extra queue
+*/
+
+class ThreadPool
+{
+private:
+	struct TaskQueue
+	{
+		std::mutex lock;
+		std::vector<std::function<void()>> ring; // ring buffer so steady state pushes never allocate
+		size_t head = 0;
+		size_t count = 0;
+
+		void push(std::function<void()>&& task)
+		{
+			std::lock_guard<std::mutex> guard(this->lock);
+			if (this->count == this->ring.size()) // full, grow and unwrap
+			{
+				std::vector<std::function<void()>> grown(std::max<size_t>(16, this->ring.size() * 2));
+				for (size_t i = 0; i < this->count; i++)
+				{
+					grown[i] = std::move(this->ring[(this->head + i) % this->ring.size()]);
+				}
+				this->ring.swap(grown);
+				this->head = 0;
+			}
+			this->ring[(this->head + this->count) % this->ring.size()] = std::move(task);
+			this->count++;
+		}
+
+		bool popBack(std::function<void()>& out) // owner side, newest task first
+		{
+			std::lock_guard<std::mutex> guard(this->lock);
+			if (this->count == 0)
+				return false;
+
+			this->count--;
+			std::function<void()>& slot = this->ring[(this->head + this->count) % this->ring.size()];
+			out = std::move(slot);
+			slot = nullptr;
+			return true;
+		}
+
+		bool popFront(std::function<void()>& out) // thief side, oldest task first
+		{
+			std::lock_guard<std::mutex> guard(this->lock);
+			if (this->count == 0)
+				return false;
+
+			std::function<void()>& slot = this->ring[this->head];
+			out = std::move(slot);
+			slot = nullptr;
+			this->head = (this->head + 1) % this->ring.size();
+			this->count--;
+			return true;
+		}
+	};
+
+	struct WorkerIdentity
+	{
+		const ThreadPool* pool = nullptr;
+		size_t index = 0;
+	};
+
+	static WorkerIdentity& currentWorker() // which pool/queue the calling thread belongs to
+	{
+		static thread_local WorkerIdentity identity;
+		return identity;
+	}
+
+	std::vector<std::thread> workers;
+	std::unique_ptr<TaskQueue[]> queues; // one per worker + one shared by outside threads
+	size_t queueCount = 0;
+
+	std::atomic<size_t> queuedTasks{ 0 }; // tasks sitting in a queue
+	std::atomic<size_t> pendingTasks{ 0 }; // tasks submitted but not finished
+	std::atomic<size_t> sleepingWorkers{ 0 };
+	std::atomic<bool> stopping{ false };
+
+	std::mutex wakeLock;
+	std::condition_variable wakeSignal;
+
+	// how long an idle worker keeps polling before it sleeps. Covers the gaps between the passes of a substep so those
+	// don't pay for a wakeup, but is over long before the next frame, so idle frames leave the cores idle.
+	const std::chrono::microseconds spinTime{ 10 };
+
+	size_t ownQueueIndex() const
+	{
+		const WorkerIdentity& identity = currentWorker();
+		return identity.pool == this ? identity.index : this->workers.size();
+	}
+
+	bool runOneTask(size_t ownIndex)
+	{
+		std::function<void()> task;
+		bool found = this->queues[ownIndex].popBack(task);
+
+		for (size_t i = 1; i < this->queueCount && !found; i++) // steal
+		{
+			found = this->queues[(ownIndex + i) % this->queueCount].popFront(task);
+		}
+
+		if (!found)
+			return false;
+
+		this->queuedTasks.fetch_sub(1);
+		task();
+		this->pendingTasks.fetch_sub(1);
+		return true;
+	}
+
+	void workerLoop(size_t index)
+	{
+		currentWorker().pool = this;
+		currentWorker().index = index;
+
+		while (true)
+		{
+			if (this->runOneTask(index))
+				continue;
+
+			bool workAppeared = false;
+			const auto spinEnd = std::chrono::steady_clock::now() + this->spinTime;
+			while (true)
+			{
+				workAppeared = this->queuedTasks.load() > 0 || this->stopping.load();
+				if (workAppeared || std::chrono::steady_clock::now() >= spinEnd)
+					break;
+				std::this_thread::yield();
+			}
+
+			if (!workAppeared)
+			{
+				std::unique_lock<std::mutex> guard(this->wakeLock);
+				this->sleepingWorkers.fetch_add(1);
+				this->wakeSignal.wait(guard, [this] { return this->stopping.load() || this->queuedTasks.load() > 0; });
+				this->sleepingWorkers.fetch_sub(1);
+			}
+
+			if (this->stopping.load() && this->queuedTasks.load() == 0)
+				return;
+		}
+	}
+
+public:
+	explicit ThreadPool(size_t threadCount = defaultThreadCount())
+	{
+		this->queueCount = threadCount + 1;
+		this->queues.reset(new TaskQueue[this->queueCount]);
+
+		this->workers.reserve(threadCount);
+		for (size_t i = 0; i < threadCount; i++)
+		{
+			this->workers.emplace_back(&ThreadPool::workerLoop, this, i);
+		}
+	}
+
+	~ThreadPool()
+	{
+		this->waitIdle();
+		{
+			std::lock_guard<std::mutex> guard(this->wakeLock);
+			this->stopping.store(true);
+		}
+		this->wakeSignal.notify_all();
+
+		for (std::thread& worker : this->workers)
+		{
+			worker.join();
+		}
+	}
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	static size_t defaultThreadCount() // the thread that owns the pool helps too, so leave it a core
+	{
+		const unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		return hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	size_t getThreadCount() const // worker threads, not counting the caller
+	{
+		return this->workers.size();
+	}
+
+	size_t currentThreadSlot() const // 1 + worker index on this pool's workers, 0 on any other thread, for per thread data
+	{
+		const WorkerIdentity& identity = currentWorker();
+		return identity.pool == this ? identity.index + 1 : 0;
+	}
+
+	void submit(std::function<void()> task)
+	{
+		if (this->workers.empty()) // nobody to hand it to, just run it
+		{
+			task();
+			return;
+		}
+
+		this->pendingTasks.fetch_add(1);
+		this->queues[this->ownQueueIndex()].push(std::move(task));
+		this->queuedTasks.fetch_add(1);
+
+		if (this->sleepingWorkers.load() > 0)
+		{
+			std::lock_guard<std::mutex> guard(this->wakeLock);
+			this->wakeSignal.notify_one();
+		}
+	}
+
+	template <class Predicate>
+	void helpUntil(Predicate done) // runs queued tasks on the calling thread until done() is true
+	{
+		const size_t ownIndex = this->ownQueueIndex();
+		while (!done())
+		{
+			if (!this->runOneTask(ownIndex))
+				std::this_thread::yield();
+		}
+	}
+
+	void waitIdle() // blocks until every submitted task has finished
+	{
+		this->helpUntil([this] { return this->pendingTasks.load() == 0; });
+	}
+
+	template <class Func>
+	void parallelFor(size_t begin, size_t end, size_t grain, Func&& func) // calls func(first, last) over [begin, end) in chunks of grain
+	{
+		if (end <= begin)
+			return;
+
+		grain = std::max<size_t>(1, grain);
+		const size_t chunkCount = (end - begin + grain - 1) / grain;
+		if (this->workers.empty() || chunkCount == 1)
+		{
+			func(begin, end);
+			return;
+		}
+
+		// chunks are handed out through a shared counter, so a few helper tasks balance the whole range
+		std::atomic<size_t> nextChunk{ 0 };
+		std::atomic<size_t> helpersDone{ 0 };
+		auto runChunks = [&]() {
+			for (size_t chunk = nextChunk.fetch_add(1); chunk < chunkCount; chunk = nextChunk.fetch_add(1))
+			{
+				const size_t first = begin + chunk * grain;
+				func(first, std::min(first + grain, end));
+			}
+		};
+		auto helper = [&]() {
+			runChunks();
+			helpersDone.fetch_add(1);
+		};
+
+		const size_t helperCount = std::min(this->workers.size(), chunkCount - 1);
+		for (size_t i = 0; i < helperCount; i++)
+		{
+			this->submit([&helper]() { helper(); }); // captures one reference so std::function stores it without allocating
+		}
+
+		runChunks();
+
+		// helpers reference this stack frame, so wait for all of them and not just the chunks
+		this->helpUntil([&]() { return helpersDone.load() == helperCount; });
+	}
+};